@@ -0,0 +1,46 @@
+/*
+ * Bench.h
+ * Timing and reporting of the benchmarks
+ *
+ * Each micro-benchmark runs its kernel a few times and reports the best time (the
+ * least disturbed by the rest of the machine), with the throughput of the kernel
+ * in the unit of what it processes.
+ *
+ */
+
+#ifndef _BENCH_H
+#define _BENCH_H
+
+#include <string>
+#include <chrono>
+#include <cstdio>
+#include <algorithm>
+
+//the best wall time of repeats runs of f, in seconds; setup is run (untimed) before each of them
+template<typename Setup, typename Function>
+double timeBest(int repeats, Setup setup, Function f) {
+    double best = 0;
+    for (int repeat = 0; repeat < std::max(1, repeats); repeat++) {
+        setup();
+        auto start = std::chrono::steady_clock::now();
+        f();
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        best = repeat == 0 ? seconds : std::min(best, seconds);
+    }
+    return best;
+}
+
+template<typename Function>
+double timeBest(int repeats, Function f) { return timeBest(repeats, [](){}, f); }
+
+//prints a line of the results: kernel, time, and the throughput in amount units/s
+inline void reportThroughput(const std::string &kernel, double seconds, double amount, const std::string &unit) {
+    printf("%-32s %10.4f s %14.2f %s/s\n", kernel.c_str(), seconds, seconds > 0 ? amount / seconds : 0.0, unit.c_str());
+    fflush(stdout);
+}
+
+//the micro-benchmarks of the compacted DBG of cdbg-ops (in their own translation unit, as cdbg-ops does not use GATB),
+//on the graph files with the given prefix
+void benchCdbg(const std::string &graphPrefix, int repeats);
+
+#endif //_BENCH_H
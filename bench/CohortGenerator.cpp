@@ -0,0 +1,129 @@
+/*
+ * CohortGenerator.cpp
+ * Deterministic generator of synthetic bacterial cohorts
+ *
+ */
+
+#include "CohortGenerator.h"
+#include <cmath>
+#include <algorithm>
+#include <fstream>
+#include <stdexcept>
+#include <boost/filesystem.hpp>
+
+using namespace std;
+
+CohortGenerator::CohortGenerator(const CohortParameters &parameters) : parameters(parameters) {
+    if (this->parameters.nbClades <= 0)
+        this->parameters.nbClades = max(1, (int)sqrt((double)parameters.nbStrains));
+
+    BenchRandom random(parameters.seed);
+    string root = randomSequence(random, parameters.genomeSize);
+    for (int clade = 0; clade < this->parameters.nbClades; clade++)
+        cladeAncestors.push_back(mutate(root, random));
+    for (int gene = 0; gene < parameters.nbAccessoryGenes; gene++) {
+        accessoryGenes.push_back(randomSequence(random, parameters.geneLength));
+        geneFrequencies.push_back(random.uniformReal());
+        geneLoci.push_back(random.next() >> 32);
+    }
+    for (int plasmid = 0; plasmid < parameters.nbPlasmids; plasmid++)
+        plasmids.push_back(randomSequence(random, parameters.plasmidLength));
+}
+
+string CohortGenerator::randomSequence(BenchRandom &random, u_int64_t length) {
+    string sequence(length, 'A');
+    for (auto &base : sequence)
+        base = random.base();
+    return sequence;
+}
+
+string CohortGenerator::mutate(const string &sequence, BenchRandom &random) const {
+    double rate = parameters.snpRate + parameters.indelRate;
+    if (rate <= 0)
+        return sequence;
+    string mutated;
+    mutated.reserve(sequence.size() + sequence.size() / 100);
+    const double logKeep = log(1 - min(rate, 0.5));
+    size_t pos = 0;
+    while (pos < sequence.size()) {
+        //the number of bases before the next mutation follows a geometric distribution
+        size_t skip = (size_t)floor(log(1 - random.uniformReal()) / logKeep);
+        if (skip >= sequence.size() - pos)
+            break;
+        mutated.append(sequence, pos, skip);
+        pos += skip;
+        if (random.uniformReal() * rate < parameters.snpRate) {
+            char base;
+            do { base = random.base(); } while (base == sequence[pos]);
+            mutated += base;
+            pos++;
+        }
+        else if (random.next() & 1) {
+            pos += 1 + random.uniform(10); //deletion
+        }
+        else {
+            mutated += randomSequence(random, 1 + random.uniform(10)); //insertion
+        }
+    }
+    if (pos < sequence.size())
+        mutated.append(sequence, pos, string::npos);
+    return mutated;
+}
+
+static string reverseComplement(const string &sequence) {
+    string revcomp(sequence.rbegin(), sequence.rend());
+    for (auto &base : revcomp)
+        base = base == 'A' ? 'T' : base == 'C' ? 'G' : base == 'G' ? 'C' : 'A';
+    return revcomp;
+}
+
+vector<string> CohortGenerator::getStrain(int strainIndex) {
+    //each strain has its own generator, so that they can be generated in any order
+    BenchRandom random(parameters.seed ^ (0xD1B54A32D192ED03ULL * (strainIndex + 1)));
+    string genome = mutate(cladeAncestors[strainIndex % parameters.nbClades], random);
+
+    //the accessory genes it carries, inserted from the last locus so that the others do not move
+    vector< pair<u_int64_t, int> > genes;
+    for (int gene = 0; gene < parameters.nbAccessoryGenes; gene++)
+        if (random.uniformReal() < geneFrequencies[gene])
+            genes.push_back(make_pair(geneLoci[gene], gene));
+    sort(genes.rbegin(), genes.rend());
+    for (const auto &gene : genes)
+        genome.insert((gene.first * genome.size()) >> 32, mutate(accessoryGenes[gene.second], random));
+
+    //cut in contigs, in either orientation
+    vector<string> contigs;
+    for (size_t begin = 0; begin < genome.size(); ) {
+        size_t length = parameters.contigLength / 2 + random.uniform(parameters.contigLength + 1);
+        string contig = genome.substr(begin, length);
+        contigs.push_back((random.next() & 1) ? reverseComplement(contig) : contig);
+        begin += length;
+    }
+    for (const auto &plasmid : plasmids)
+        if (random.uniformReal() < parameters.plasmidFrequency)
+            contigs.push_back(mutate(plasmid, random));
+    return contigs;
+}
+
+string CohortGenerator::write(const string &folder) {
+    string strainsFolder = folder + "/strains";
+    boost::filesystem::create_directories(strainsFolder);
+    string strainsFilename = folder + "/strains.txt";
+    ofstream strainsFile(strainsFilename);
+    if (!strainsFile)
+        throw runtime_error("Could not open file " + strainsFilename + " for writing");
+    strainsFile << "ID\tPath\n";
+
+    for (int strain = 0; strain < parameters.nbStrains; strain++) {
+        string id = "strain_" + to_string(strain);
+        string path = strainsFolder + "/" + id + ".fa";
+        ofstream fasta(path);
+        if (!fasta)
+            throw runtime_error("Could not open file " + path + " for writing");
+        vector<string> contigs = getStrain(strain);
+        for (size_t contig = 0; contig < contigs.size(); contig++)
+            fasta << ">" << id << "_contig_" << contig << "\n" << contigs[contig] << "\n";
+        strainsFile << id << "\t" << path << "\n";
+    }
+    return strainsFilename;
+}
@@ -0,0 +1,85 @@
+/*
+ * CohortGenerator.h
+ * Deterministic generator of synthetic bacterial cohorts, for the benchmarks
+ *
+ * A random core genome is mutated into clade ancestors, then into the strains of each
+ * clade (SNPs and short indels, at the given rate per base and generation), so that
+ * the strains share most of their unitigs and many of their presence patterns, as in
+ * real populations. Each accessory gene has its own frequency in the cohort and is
+ * inserted at its own locus of the strains that carry it (gain/loss), and plasmids are
+ * carried as separate contigs. The genomes are written as assemblies, cut in contigs.
+ *
+ * The generator only uses its own 64-bit PRNG (not the std distributions, which differ
+ * between standard libraries): the same parameters give the same cohort everywhere.
+ *
+ */
+
+#ifndef _COHORTGENERATOR_H
+#define _COHORTGENERATOR_H
+
+#include <string>
+#include <vector>
+#include <sys/types.h>
+
+struct CohortParameters {
+    u_int64_t genomeSize = 2000000;   //bases of the core genome
+    int nbStrains = 50;
+    int nbClades = 0;                 //0 for sqrt(nbStrains)
+    double snpRate = 0.002;           //per base, from the root to a clade ancestor and from it to a strain
+    double indelRate = 0.0002;        //same, for indels of 1 to 10 bases
+    int nbAccessoryGenes = 200;
+    u_int64_t geneLength = 1000;
+    int nbPlasmids = 3;
+    u_int64_t plasmidLength = 50000;
+    double plasmidFrequency = 0.3;    //fraction of the strains carrying each plasmid
+    u_int64_t contigLength = 100000;  //mean length of the contigs of the assemblies
+    u_int64_t seed = 42;
+};
+
+//xorshift64* generator
+class BenchRandom {
+public:
+    BenchRandom(u_int64_t seed) : state(seed * 0x9E3779B97F4A7C15ULL + 1) {}
+
+    u_int64_t next() {
+        state ^= state >> 12;
+        state ^= state << 25;
+        state ^= state >> 27;
+        return state * 0x2545F4914F6CDD1DULL;
+    }
+    //in [0, n)
+    u_int64_t uniform(u_int64_t n) { return next() % n; }
+    //in [0, 1)
+    double uniformReal() { return (next() >> 11) * (1.0 / 9007199254740992.0); }
+    char base() { return "ACGT"[next() >> 62]; }
+
+private:
+    u_int64_t state;
+};
+
+class CohortGenerator {
+public:
+    CohortGenerator(const CohortParameters &parameters);
+
+    //the contigs of the i-th strain
+    std::vector<std::string> getStrain(int strainIndex);
+
+    //writes the strains in folder/strains/<id>.fa, and the strains file (for -strains) in folder/strains.txt
+    //returns the name of the strains file
+    std::string write(const std::string &folder);
+
+    const CohortParameters& getParameters() const { return parameters; }
+
+private:
+    CohortParameters parameters;
+    std::vector<std::string> cladeAncestors;
+    std::vector<std::string> accessoryGenes, plasmids;
+    std::vector<double> geneFrequencies;
+    std::vector<u_int64_t> geneLoci; //relative position, in 1/2^32 of the genome
+
+    static std::string randomSequence(BenchRandom &random, u_int64_t length);
+    //a copy of sequence with SNPs and indels
+    std::string mutate(const std::string &sequence, BenchRandom &random) const;
+};
+
+#endif //_COHORTGENERATOR_H
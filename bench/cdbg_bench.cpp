@@ -0,0 +1,27 @@
+/*
+ * cdbg_bench.cpp
+ * Micro-benchmarks of the compacted DBG of cdbg-ops
+ *
+ */
+
+#include "Bench.h"
+#include "node_dists.hpp"
+#include <memory>
+#include <limits>
+
+void benchCdbg(const string &graphPrefix, int repeats) {
+    unique_ptr<Cdbg> cdbg;
+    double seconds = timeBest(repeats, [&]() { cdbg.reset(); }, [&]() { cdbg.reset(new Cdbg(graphPrefix)); });
+    size_t nbNodes = 0;
+    for (ifstream nodes(graphPrefix + ".nodes"); nodes.ignore(numeric_limits<streamsize>::max(), '\n'); )
+        nbNodes++;
+    reportThroughput("cdbg_load", seconds, nbNodes, "unitigs");
+
+    if (nbNodes == 0)
+        return;
+    seconds = timeBest(repeats, [&]() { cdbg->node_distance(0); });
+    reportThroughput("cdbg_node_distance", seconds, nbNodes, "unitigs");
+
+    seconds = timeBest(repeats, [&]() { cdbg->extend_hits(0, 100); });
+    reportThroughput("cdbg_extend_hits", seconds, 1, "queries");
+}
@@ -0,0 +1,329 @@
+/*
+ * unitig_bench.cpp
+ * Benchmarks of unitig-counter: synthetic cohorts, micro-benchmarks of the hot kernels,
+ * and end-to-end runs reporting the throughput and memory of each stage
+ *
+ *  unitig-bench generate --output cohort [cohort options]
+ *      writes a synthetic cohort (cohort/strains.txt and its assemblies)
+ *  unitig-bench micro [cohort and kernel options] [--graph output/graph]
+ *      times the kernels on synthetic data: kmer streaming, 2-bit sequence cache, transpose,
+ *      dedup, Rtab formatting and BGZF compression (and the cdbg-ops graph, given a graph)
+ *  unitig-bench macro --output folder [cohort options]
+ *      generates a cohort and runs unitig-counter on it; graph construction, unitig and edge
+ *      construction (GraphOutput), mapping (mapReadToTheGraphCore) and the writers are
+ *      reported from the stages of run_stats.json
+ *  unitig-bench check [cohort options]
+ *      checks the generator: the same seed gives the same strains, in any order, and
+ *      they are only made of ACGT (exits with 1 otherwise)
+ *
+ * The benchmarks are not tests: they are run by hand, to compare builds on the same machine.
+ *
+ */
+
+#include <boost/program_options.hpp>
+#define BOOST_NO_CXX11_SCOPED_ENUMS
+#include <boost/filesystem.hpp>
+#undef BOOST_NO_CXX11_SCOPED_ENUMS
+#include "build_dbg.hpp"
+#include "map_reads.hpp"
+#include "global.h"
+#include "KmerStreamer.h"
+#include "BitMatrix.h"
+#include "BgzfSink.h"
+#include "SequenceCache.h"
+#include "RunStats.h"
+#include "CohortGenerator.h"
+#include "Bench.h"
+
+namespace po = boost::program_options;
+
+static CohortParameters getCohortParameters(const po::variables_map &vm) {
+    CohortParameters parameters;
+    parameters.genomeSize = vm["genome-size"].as<u_int64_t>();
+    parameters.nbStrains = vm["strains"].as<int>();
+    parameters.nbClades = vm["clades"].as<int>();
+    parameters.snpRate = vm["snp-rate"].as<double>();
+    parameters.indelRate = vm["indel-rate"].as<double>();
+    parameters.nbAccessoryGenes = vm["accessory-genes"].as<int>();
+    parameters.geneLength = vm["gene-length"].as<u_int64_t>();
+    parameters.nbPlasmids = vm["plasmids"].as<int>();
+    parameters.plasmidLength = vm["plasmid-length"].as<u_int64_t>();
+    parameters.plasmidFrequency = vm["plasmid-frequency"].as<double>();
+    parameters.contigLength = vm["contig-length"].as<u_int64_t>();
+    parameters.seed = vm["seed"].as<u_int64_t>();
+    return parameters;
+}
+
+//a strains x unitigs matrix of random bits
+static BitMatrix getRandomMatrix(size_t nbRows, size_t nbCols, BenchRandom &random) {
+    BitMatrix matrix(nbRows, nbCols);
+    u_int64_t lastWordMask = (nbCols % 64) ? ((u_int64_t)1 << (nbCols % 64)) - 1 : ~(u_int64_t)0;
+    for (size_t row = 0; row < nbRows; row++) {
+        u_int64_t *words = matrix.getRow(row);
+        for (size_t word = 0; word < matrix.getNbWordsPerRow(); word++)
+            words[word] = random.next();
+        words[matrix.getNbWordsPerRow() - 1] &= lastWordMask;
+    }
+    return matrix;
+}
+
+static void runMicro(const po::variables_map &vm) {
+    const int repeats = vm["repeats"].as<int>();
+    const int nbThreads = vm["threads"].as<int>();
+    const size_t nbUnitigs = vm["unitigs"].as<u_int64_t>();
+    const size_t nbPatterns = max<size_t>(1, nbUnitigs * vm["unique-fraction"].as<double>());
+    CohortGenerator generator(getCohortParameters(vm));
+    const size_t nbStrains = generator.getParameters().nbStrains;
+    BenchRandom random(generator.getParameters().seed);
+
+    //kmer streaming, the inner loop of the mapping: kmers of a strain, with their canonical node
+    {
+        vector<string> contigs = generator.getStrain(0);
+        u_int64_t nbKmers = 0, checksum = 0;
+        KmerStreamer<KMER_SPAN(0)> kmerStreamer(31);
+        double seconds = timeBest(repeats, [&]() {
+            nbKmers = 0;
+            for (const auto &contig : contigs) {
+                kmerStreamer.reset(contig.c_str(), contig.size());
+                while (kmerStreamer.next()) {
+                    nbKmers++;
+                    checksum += kmerStreamer.node().strand;
+                }
+            }
+        });
+        reportThroughput("kmer_streamer", seconds, nbKmers, "kmers");
+        if (checksum == 0)
+            cerr << "(no kmers streamed)" << endl;
+    }
+
+    //the 2-bit sequence cache: parsing the strains into it, then decoding them
+    string workFolder = vm["work"].as<string>();
+    boost::filesystem::create_directories(workFolder);
+    {
+        vector<Strain> cohortStrains;
+        vector<int> strainIndices;
+        {
+            string strainsFilename = generator.write(workFolder + "/cohort");
+            ifstream strainsFile(strainsFilename);
+            string line, id, path;
+            getline(strainsFile, line);
+            while (strainsFile >> id >> path) {
+                strainIndices.push_back(cohortStrains.size());
+                cohortStrains.push_back(Strain(id, path));
+            }
+        }
+        string cacheFilename = workFolder + "/sequences.cache";
+        double seconds = timeBest(repeats, [&]() { SequenceCache::build(cacheFilename, cohortStrains, strainIndices, nbThreads); });
+        SequenceCache cache(cacheFilename);
+        u_int64_t nbBases = 0;
+        for (size_t i = 0; i < cache.getNbStrains(); i++)
+            nbBases += cache.getNbBases(i);
+        reportThroughput("sequence_cache_build", seconds, nbBases / 1e6, "Mbases");
+
+        vector<string> sequences;
+        seconds = timeBest(repeats, [&]() {
+            for (size_t i = 0; i < cache.getNbStrains(); i++)
+                cache.getSequences(i, sequences);
+        });
+        reportThroughput("sequence_cache_decode", seconds, nbBases / 1e6, "Mbases");
+    }
+
+    //transpose of the strains x unitigs matrix (which it consumes)
+    {
+        BitMatrix XUT;
+        double seconds = timeBest(repeats, [&]() { XUT = getRandomMatrix(nbStrains, nbUnitigs, random); },
+                                           [&]() { transposeXU(XUT, nbThreads); });
+        reportThroughput("transpose", seconds, nbStrains * (double)nbUnitigs / 8 / 1e6, "MB");
+    }
+
+    //dedup of the unitigs x strains matrix, whose rows are drawn from nbPatterns patterns
+    BitMatrix XU(nbUnitigs, nbStrains);
+    {
+        BitMatrix patterns = getRandomMatrix(nbPatterns, nbStrains, random);
+        for (size_t unitig = 0; unitig < nbUnitigs; unitig++) {
+            const u_int64_t *pattern = patterns.getRow(unitig < nbPatterns ? unitig : random.uniform(nbPatterns));
+            copy(pattern, pattern + XU.getNbWordsPerRow(), XU.getRow(unitig));
+        }
+    }
+    UniquePatterns pattern2Unitigs;
+    double seconds = timeBest(repeats, [&]() { pattern2Unitigs = getUnitigsWithSamePattern(XU, nbThreads); });
+    reportThroughput("dedup", seconds, nbUnitigs, "unitigs");
+
+    //the writers: formatting the Rtab lines of the unique patterns, then compressing them
+    string rtab;
+    seconds = timeBest(repeats, [&]() {
+        rtab.clear();
+        for (size_t pattern = 0; pattern < pattern2Unitigs.size(); pattern++)
+            appendRtabLine(rtab, pattern, XU.getRow(pattern2Unitigs.representatives[pattern]), nbStrains);
+    });
+    reportThroughput("rtab_format", seconds, rtab.size() / 1e6, "MB");
+
+    seconds = timeBest(repeats, [&]() {
+        BgzfSink sink(workFolder + "/unitigs.unique_rows.Rtab.gz", nbThreads);
+        for (size_t begin = 0; begin < rtab.size(); begin += 1 << 20)
+            sink.write(rtab.data() + begin, min<size_t>(1 << 20, rtab.size() - begin));
+        sink.close();
+    });
+    reportThroughput("bgzf_compress", seconds, rtab.size() / 1e6, "MB");
+
+    //the compacted DBG of cdbg-ops, on the graph of a previous run
+    if (vm.count("graph"))
+        benchCdbg(vm["graph"].as<string>(), repeats);
+}
+
+static void runMacro(const po::variables_map &vm) {
+    string outputFolder = vm["output"].as<string>();
+    string runFolder = outputFolder + "/run";
+    boost::filesystem::create_directories(outputFolder);
+    boost::filesystem::remove_all(runFolder);
+
+    cerr << "Generating the cohort in " << outputFolder << "/cohort..." << endl;
+    CohortGenerator generator(getCohortParameters(vm));
+    string strainsFilename = generator.write(outputFolder + "/cohort");
+
+    //the same arguments as a unitig-counter run
+    vector<string> arguments = {"unitig-counter", "-strains", strainsFilename, "-output", runFolder,
+                                "-nb-cores", to_string(vm["threads"].as<int>()), "-k", to_string(vm["k"].as<int>())};
+    if (vm.count("gzip"))
+        arguments.push_back("-gzip");
+    vector<char*> argv;
+    for (auto &argument : arguments)
+        argv.push_back(&argument[0]);
+    build_dbg().run(argv.size(), argv.data());
+    map_reads().run(argv.size(), argv.data());
+
+    //the throughput of each stage, in each of its counts, and of its writes
+    printf("\n%-32s %10s %10s %12s %12s  %s\n", "stage", "wall (s)", "cpu (s)", "peak (MB)", "written MB/s", "throughput");
+    for (const auto &stage : RunStats::getStages()) {
+        double seconds = stage.end.wallSeconds - stage.start.wallSeconds;
+        double written = (stage.end.bytesWritten - stage.start.bytesWritten) / 1e6;
+        printf("%-32s %10.3f %10.3f %12.1f %12.2f ", stage.name.c_str(), seconds, stage.end.cpuSeconds - stage.start.cpuSeconds,
+               stage.peakRss / 1e6, seconds > 0 ? written / seconds : 0.0);
+        for (const auto &count : stage.counts)
+            printf(" %.0f %s/s", seconds > 0 ? count.second / seconds : 0.0, count.first.c_str());
+        printf("\n");
+    }
+    ResourceUsage total = ResourceUsage::now();
+    printf("%-32s %10.3f %10.3f %12.1f\n", "total", total.wallSeconds, total.cpuSeconds, total.peakRss / 1e6);
+    printf("\nThe stats of the run are in %s/run_stats.json\n", runFolder.c_str());
+}
+
+//FNV-1a hash of the contigs of a strain
+static u_int64_t hashStrain(const vector<string> &contigs) {
+    u_int64_t hash = 0xCBF29CE484222325ULL;
+    for (const auto &contig : contigs)
+        for (const char c : contig + ">")
+            hash = (hash ^ (unsigned char)c) * 0x100000001B3ULL;
+    return hash;
+}
+
+//the benchmarks are only comparable if the cohort is the same for the same parameters
+static bool runCheck(const po::variables_map &vm) {
+    CohortParameters parameters = getCohortParameters(vm);
+    CohortGenerator generator(parameters), sameGenerator(parameters);
+    parameters.seed++;
+    CohortGenerator otherGenerator(parameters);
+
+    bool passed = true;
+    auto fail = [&](const string &message) {
+        cerr << "FAILED: " << message << endl;
+        passed = false;
+    };
+    vector<u_int64_t> hashes;
+    for (int strain = 0; strain < parameters.nbStrains; strain++)
+        hashes.push_back(hashStrain(generator.getStrain(strain)));
+    //the second generator goes from the last strain, so that the order they are generated in is checked too
+    bool sameAsOtherSeed = true;
+    for (int strain = parameters.nbStrains - 1; strain >= 0; strain--) {
+        vector<string> contigs = sameGenerator.getStrain(strain);
+        if (hashStrain(contigs) != hashes[strain])
+            fail("strain " + to_string(strain) + " differs between two generators of the same seed");
+        if (contigs.empty())
+            fail("strain " + to_string(strain) + " has no contig");
+        for (const auto &contig : contigs)
+            if (contig.empty() || contig.find_first_not_of("ACGT") != string::npos)
+                fail("a contig of strain " + to_string(strain) + " is empty or not made of ACGT");
+        sameAsOtherSeed = sameAsOtherSeed && hashStrain(otherGenerator.getStrain(strain)) == hashes[strain];
+    }
+    if (sameAsOtherSeed)
+        fail("another seed gives the same strains");
+    if (passed)
+        cout << "The generator passed its checks on " << parameters.nbStrains << " strains." << endl;
+    return passed;
+}
+
+int main(int argc, char *argv[]) {
+    po::options_description cohort("Cohort options");
+    cohort.add_options()
+        ("genome-size", po::value<u_int64_t>()->default_value(2000000), "Bases of the core genome")
+        ("strains", po::value<int>()->default_value(50), "Number of strains")
+        ("clades", po::value<int>()->default_value(0), "Number of clades (0 for sqrt(strains))")
+        ("snp-rate", po::value<double>()->default_value(0.002), "SNPs per base, per generation (root to clade, clade to strain)")
+        ("indel-rate", po::value<double>()->default_value(0.0002), "Indels (1 to 10 bases) per base, per generation")
+        ("accessory-genes", po::value<int>()->default_value(200), "Number of accessory genes, each gained or lost at its own frequency")
+        ("gene-length", po::value<u_int64_t>()->default_value(1000), "Length of the accessory genes")
+        ("plasmids", po::value<int>()->default_value(3), "Number of plasmids")
+        ("plasmid-length", po::value<u_int64_t>()->default_value(50000), "Length of the plasmids")
+        ("plasmid-frequency", po::value<double>()->default_value(0.3), "Fraction of the strains carrying each plasmid")
+        ("contig-length", po::value<u_int64_t>()->default_value(100000), "Mean length of the contigs of the assemblies")
+        ("seed", po::value<u_int64_t>()->default_value(42), "Seed of the generator");
+
+    po::options_description run("Benchmark options");
+    run.add_options()
+        ("output", po::value<string>(), "Output folder (generate and macro)")
+        ("threads", po::value<int>()->default_value(4), "Number of threads")
+        ("repeats", po::value<int>()->default_value(3), "Runs of each micro-benchmark (the best is reported)")
+        ("unitigs", po::value<u_int64_t>()->default_value(1000000), "Number of unitigs of the matrix of the micro-benchmarks")
+        ("unique-fraction", po::value<double>()->default_value(0.1), "Fraction of unique patterns in the matrix of the micro-benchmarks")
+        ("work", po::value<string>()->default_value("unitig-bench-work"), "Folder of the files of the micro-benchmarks")
+        ("graph", po::value<string>(), "Prefix of the graph files of a run, to benchmark cdbg-ops on it (micro)")
+        ("k", po::value<int>()->default_value(31), "K-mer size (macro)")
+        ("gzip", "Compress the outputs (macro)")
+        ("mode", po::value<string>(), "generate, micro, macro or check")
+        ("help,h", "Full help message");
+
+    po::options_description all;
+    all.add(cohort).add(run);
+    po::positional_options_description mode;
+    mode.add("mode", 1);
+
+    po::variables_map vm;
+    try {
+        po::store(po::command_line_parser(argc, argv).positional(mode).options(all).run(), vm);
+        po::notify(vm);
+    } catch (po::error &e) {
+        cerr << "Error in command line input: " << e.what() << endl << all << endl;
+        return 1;
+    }
+    string modeName = vm.count("mode") ? vm["mode"].as<string>() : "";
+    if (vm.count("help") || (modeName != "generate" && modeName != "micro" && modeName != "macro" && modeName != "check") ||
+        ((modeName == "generate" || modeName == "macro") && !vm.count("output"))) {
+        cerr << "unitig-bench generate --output cohort: write a synthetic cohort" << endl;
+        cerr << "unitig-bench micro: time the hot kernels on synthetic data" << endl;
+        cerr << "unitig-bench macro --output folder: run unitig-counter on a synthetic cohort" << endl;
+        cerr << "unitig-bench check: check that the cohorts are deterministic and made of ACGT" << endl;
+        cerr << all << endl;
+        return 1;
+    }
+
+    try {
+        if (modeName == "generate") {
+            CohortGenerator generator(getCohortParameters(vm));
+            cout << generator.write(vm["output"].as<string>()) << endl;
+        }
+        else if (modeName == "micro") {
+            runMicro(vm);
+        }
+        else if (modeName == "check") {
+            return runCheck(vm) ? 0 : 1;
+        }
+        else {
+            runMacro(vm);
+        }
+    }
+    catch (Exception &e) {
+        cerr << "EXCEPTION: " << e.getMessage() << endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,169 @@
+/*
+ * BgzfSink.h
+ * Boost iostreams sink writing a BGZF file (blocked gzip), compressed with several threads
+ *
+ * The output is cut in blocks of at most BGZF_BLOCK_SIZE bytes, each compressed as an
+ * independent gzip member with the BGZF extra field (as samtools' bgzip does), so the
+ * file is still read by zcat, gzip readers and pyseer. Blocks are buffered and a batch
+ * of them is compressed by the threads, then written in order. On close, the empty BGZF
+ * EOF block is added, and the block index is written in filename.gzi (bgzip -i format:
+ * the number of entries, then the compressed and uncompressed offsets of each block but
+ * the first, as little-endian 64-bit integers), so that downstream tools can seek.
+ *
+ * The sink must be closed (closing the stream does it) for the file to be complete: a
+ * write error is then fatal, while a sink destroyed without being closed only closes
+ * its file, left without its EOF block so that readers see it is truncated.
+ *
+ */
+
+#ifndef _BGZFSINK_H
+#define _BGZFSINK_H
+
+#include <gatb/gatb_core.hpp>
+#include <boost/iostreams/categories.hpp>
+#include <memory>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <zlib.h>
+#include "Utils.h"
+
+#define BGZF_BLOCK_SIZE 0xff00 //max uncompressed size of a block, so that a compressed block always fits in 64KB
+#define BGZF_MAX_COMPRESSED_BLOCK_SIZE 0x10000
+#define BGZF_BLOCKS_PER_THREAD 4 //Nb of blocks buffered per compression thread before compressing them
+
+class BgzfSink {
+public:
+    typedef char char_type;
+    struct category : boost::iostreams::sink_tag, boost::iostreams::closable_tag {};
+
+    //nbThreads: number of compression threads (0 means all cores)
+    BgzfSink(const std::string &filename, int nbThreads, int level = Z_DEFAULT_COMPRESSION) :
+        state(std::make_shared<State>(filename, nbThreads, level)) {}
+
+    std::streamsize write(const char *s, std::streamsize n) {
+        state->pending.append(s, n);
+        if (state->pending.size() >= state->blocks.size() * BGZF_BLOCK_SIZE)
+            state->compressAndWrite(false);
+        return n;
+    }
+
+    void close() { state->finish(); }
+
+private:
+    struct State {
+        std::string filename;
+        FILE *file;
+        Dispatcher dispatcher;
+        int level;
+        std::string pending;
+        std::vector<std::string> blocks;
+        u_int64_t compressedOffset, uncompressedOffset;
+        std::vector< std::pair<u_int64_t, u_int64_t> > index;
+
+        State(const std::string &filename, int nbThreads, int level) :
+            filename(filename), dispatcher(nbThreads), level(level), compressedOffset(0), uncompressedOffset(0) {
+            file = fopen(filename.c_str(), "wb");
+            if (file == NULL)
+                fatalError("Could not open file " + filename + " for writing");
+            blocks.resize(BGZF_BLOCKS_PER_THREAD * dispatcher.getExecutionUnitsNumber());
+        }
+
+        //must not fail: the file is only finished by close()
+        ~State() {
+            if (file != NULL)
+                fclose(file);
+        }
+
+        void writeOrFail(const void *data, size_t size, FILE *output, const std::string &outputName) {
+            if (size > 0 && fwrite(data, 1, size, output) != size)
+                fatalError("Could not write to file " + outputName + " (disk full?)");
+        }
+
+        //compresses the pending data in parallel, by blocks, and writes them in order
+        //only full blocks are written, unless this is the last call
+        void compressAndWrite(bool last) {
+            size_t nbBlocks = last ? (pending.size() + BGZF_BLOCK_SIZE - 1) / BGZF_BLOCK_SIZE : pending.size() / BGZF_BLOCK_SIZE;
+            if (nbBlocks == 0)
+                return;
+            if (nbBlocks > blocks.size())
+                blocks.resize(nbBlocks);
+
+            Range<size_t>::Iterator blocksIt(0, nbBlocks - 1);
+            dispatcher.iterate(blocksIt, [&](size_t block) {
+                size_t begin = block * BGZF_BLOCK_SIZE;
+                compressBlock(pending.data() + begin, std::min<size_t>(BGZF_BLOCK_SIZE, pending.size() - begin), level, blocks[block]);
+            }, 1);
+
+            for (size_t block = 0; block < nbBlocks; block++) {
+                if (compressedOffset > 0)
+                    index.push_back(std::make_pair(compressedOffset, uncompressedOffset));
+                writeOrFail(blocks[block].data(), blocks[block].size(), file, filename);
+                compressedOffset += blocks[block].size();
+                uncompressedOffset += std::min<size_t>(BGZF_BLOCK_SIZE, pending.size() - block * BGZF_BLOCK_SIZE);
+            }
+            pending.erase(0, std::min(pending.size(), nbBlocks * BGZF_BLOCK_SIZE));
+        }
+
+        void finish() {
+            if (file == NULL)
+                return;
+            compressAndWrite(true);
+
+            //the BGZF end-of-file marker, an empty block
+            std::string eof;
+            compressBlock(NULL, 0, level, eof);
+            writeOrFail(eof.data(), eof.size(), file, filename);
+            int closed = fclose(file);
+            file = NULL;
+            if (closed != 0)
+                fatalError("Could not write to file " + filename + " (disk full?)");
+
+            FILE *indexFile = fopen((filename + ".gzi").c_str(), "wb");
+            if (indexFile == NULL)
+                fatalError("Could not open file " + filename + ".gzi for writing");
+            u_int64_t nbEntries = index.size();
+            writeOrFail(&nbEntries, sizeof(u_int64_t), indexFile, filename + ".gzi");
+            for (const auto &entry : index) {
+                writeOrFail(&entry.first, sizeof(u_int64_t), indexFile, filename + ".gzi");
+                writeOrFail(&entry.second, sizeof(u_int64_t), indexFile, filename + ".gzi");
+            }
+            if (fclose(indexFile) != 0)
+                fatalError("Could not write to file " + filename + ".gzi (disk full?)");
+        }
+    };
+
+    static void putLittleEndian(std::string &block, size_t pos, u_int64_t value, int nbBytes) {
+        for (int i = 0; i < nbBytes; i++)
+            block[pos + i] = (char)((value >> (8 * i)) & 0xff);
+    }
+
+    //compresses data[0..size) in a BGZF block: a gzip member whose extra field BC gives the size of the block
+    static void compressBlock(const char *data, size_t size, int level, std::string &block) {
+        static const unsigned char header[18] = {0x1f, 0x8b, 8, 4, 0, 0, 0, 0, 0, 0xff, 6, 0, 'B', 'C', 2, 0, 0, 0};
+        block.assign((const char *)header, 18);
+        block.resize(BGZF_MAX_COMPRESSED_BLOCK_SIZE);
+
+        z_stream stream;
+        stream.zalloc = Z_NULL;
+        stream.zfree = Z_NULL;
+        stream.opaque = Z_NULL;
+        stream.next_in = (Bytef *)data;
+        stream.avail_in = size;
+        stream.next_out = (Bytef *)&block[18];
+        stream.avail_out = BGZF_MAX_COMPRESSED_BLOCK_SIZE - 18 - 8;
+        if (deflateInit2(&stream, level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK ||
+            deflate(&stream, Z_FINISH) != Z_STREAM_END || deflateEnd(&stream) != Z_OK)
+            fatalError("zlib failed to compress a BGZF block");
+
+        size_t blockSize = 18 + stream.total_out + 8;
+        block.resize(blockSize);
+        putLittleEndian(block, 16, blockSize - 1, 2);
+        putLittleEndian(block, blockSize - 8, crc32(crc32(0L, Z_NULL, 0), (const Bytef *)data, size), 4);
+        putLittleEndian(block, blockSize - 4, size, 4);
+    }
+
+    std::shared_ptr<State> state;
+};
+
+#endif //_BGZFSINK_H
@@ -0,0 +1,68 @@
+/*
+ * BitMatrix.h
+ * Dense bit matrix stored as blocks of 64 rows, with a 64x64 tile transpose
+ *
+ * Each row is a run of 64-bit words (bit j of a row is bit j%64 of its word j/64).
+ * The rows are grouped by 64 in separately allocated blocks, so that a block can be
+ * released once it is consumed, and so that a block of 64 rows and a word of
+ * columns make a 64x64 tile, the unit of the transpose.
+ *
+ */
+
+#ifndef _BITMATRIX_H
+#define _BITMATRIX_H
+
+#include <vector>
+#include <sys/types.h>
+
+class BitMatrix {
+public:
+    BitMatrix(size_t nbRows=0, size_t nbCols=0) : nbRows(nbRows), nbCols(nbCols), nbWordsPerRow((nbCols + 63) / 64) {
+        blocks.resize((nbRows + 63) / 64);
+        for (size_t block = 0; block < blocks.size(); block++)
+            blocks[block].resize(getNbRowsInBlock(block) * nbWordsPerRow, 0);
+    }
+
+    size_t getNbRows() const { return nbRows; }
+    size_t getNbCols() const { return nbCols; }
+    size_t getNbWordsPerRow() const { return nbWordsPerRow; }
+    size_t getNbBlocks() const { return blocks.size(); }
+    size_t getNbRowsInBlock(size_t block) const { return (block + 1) * 64 <= nbRows ? 64 : nbRows - block * 64; }
+
+    u_int64_t* getRow(size_t row) { return blocks[row >> 6].data() + (row & 63) * nbWordsPerRow; }
+    const u_int64_t* getRow(size_t row) const { return blocks[row >> 6].data() + (row & 63) * nbWordsPerRow; }
+
+    bool test(size_t row, size_t col) const { return (getRow(row)[col >> 6] >> (col & 63)) & 1; }
+    void set(size_t row, size_t col) { getRow(row)[col >> 6] |= (u_int64_t)1 << (col & 63); }
+
+    //frees the memory of a block of rows, which must not be accessed anymore
+    void releaseBlock(size_t block) { std::vector<u_int64_t>().swap(blocks[block]); }
+
+    //calls f(col) for each set bit of a row of nbWords words, in increasing order
+    template<typename Function>
+    static void forEachSetBit(const u_int64_t *row, size_t nbWords, Function f) {
+        for (size_t word = 0; word < nbWords; word++) {
+            for (u_int64_t bits = row[word]; bits != 0; bits &= bits - 1)
+                f(word * 64 + __builtin_ctzll(bits));
+        }
+    }
+
+    //transposes in place a 64x64 tile given as 64 rows: bit j of tile[i] goes to bit i of tile[j]
+    //(each step swaps the off-diagonal quadrants of all sub-tiles, which halve in size)
+    static void transposeTile(u_int64_t tile[64]) {
+        u_int64_t mask = 0x00000000FFFFFFFFULL;
+        for (int width = 32; width != 0; width >>= 1, mask ^= (mask << width)) {
+            for (int row = 0; row < 64; row = ((row | width) + 1) & ~width) {
+                u_int64_t swapped = ((tile[row] >> width) ^ tile[row | width]) & mask;
+                tile[row] ^= swapped << width;
+                tile[row | width] ^= swapped;
+            }
+        }
+    }
+
+private:
+    size_t nbRows, nbCols, nbWordsPerRow;
+    std::vector< std::vector<u_int64_t> > blocks;
+};
+
+#endif //_BITMATRIX_H
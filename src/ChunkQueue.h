@@ -0,0 +1,157 @@
+/*
+ * ChunkQueue.h
+ * Work queue handing strain files and chunks of their sequences to the mapping threads
+ *
+ * A thread asking for work first gets a chunk of an already loaded file; only when
+ * there is none left it is asked to load the next file, which it then splits into
+ * chunks pushed back here for every thread to take. This keeps all threads busy even
+ * when there are fewer (or much bigger) files than threads.
+ *
+ * With read-ahead, the files are instead loaded (parsed and decompressed) by dedicated
+ * reader threads, which keep at most maxStrainsAhead loaded strains waiting in the
+ * queue, so that the mapping threads only map.
+ *
+ * A thread failing to load a file (or to map) must stop the queue: the others are then
+ * told there is no more work, instead of waiting forever for the chunks of that file.
+ *
+ */
+
+#ifndef _CHUNKQUEUE_H
+#define _CHUNKQUEUE_H
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+
+//the sequences of a strain, loaded in memory
+struct StrainSequences {
+    int strainIndex;
+    std::vector<std::string> sequences;
+    StrainSequences(int strainIndex) : strainIndex(strainIndex) {}
+};
+
+//a unit of work: some pieces of sequences of a strain
+struct SequenceChunk {
+    struct Piece {
+        size_t sequence, begin, end;
+        Piece(size_t sequence, size_t begin, size_t end) : sequence(sequence), begin(begin), end(end) {}
+    };
+    std::shared_ptr<const StrainSequences> strain;
+    std::vector<Piece> pieces;
+
+    //splits the sequences into chunks of about chunkSize bases. Sequences longer than that are cut in pieces
+    //overlapping by kmerSize-1 bases, so that each kmer is in exactly one piece
+    static std::vector<SequenceChunk> split(const std::shared_ptr<const StrainSequences> &strain, size_t chunkSize, size_t kmerSize) {
+        std::vector<SequenceChunk> chunks;
+        SequenceChunk chunk;
+        chunk.strain = strain;
+        size_t chunkLength = 0;
+        for (size_t i = 0; i < strain->sequences.size(); i++) {
+            size_t length = strain->sequences[i].size();
+            if (length < kmerSize)
+                continue;
+            for (size_t begin = 0; begin + kmerSize <= length; begin += chunkSize) {
+                size_t end = std::min(length, begin + chunkSize + kmerSize - 1);
+                chunk.pieces.push_back(Piece(i, begin, end));
+                chunkLength += end - begin;
+                if (chunkLength >= chunkSize) {
+                    chunks.push_back(chunk);
+                    chunk.pieces.clear();
+                    chunkLength = 0;
+                }
+            }
+        }
+        if (!chunk.pieces.empty())
+            chunks.push_back(chunk);
+        return chunks;
+    }
+};
+
+class ChunkQueue {
+public:
+    //filesToLoad: indexes of the files to be loaded and mapped
+    //maxStrainsAhead: 0 if the files are loaded by the mapping threads, or the max number of strains loaded
+    //by the reader threads and not yet taken
+    ChunkQueue(const std::vector<int> &filesToLoad, size_t maxStrainsAhead = 0) :
+        filesToLoad(filesToLoad), nextFile(0), nbFilesLoading(0), maxStrainsAhead(maxStrainsAhead), nbStrainsQueued(0), stopped(false) {}
+
+    //blocks until there is some work: returns true with either a chunk to map (fileToLoad == -1)
+    //or the index of a file to load (which must then be given back with push()).
+    //returns false when all files are loaded and all chunks were taken, or when the queue was stopped
+    bool next(SequenceChunk &chunk, int &fileToLoad) {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            if (stopped)
+                return false;
+            if (!chunks.empty()) {
+                chunk = chunks.front();
+                chunks.pop_front();
+                fileToLoad = -1;
+                //the chunks of a strain are contiguous: this was its last one
+                if (chunks.empty() || chunks.front().strain != chunk.strain) {
+                    nbStrainsQueued--;
+                    readSlotAvailable.notify_one();
+                }
+                return true;
+            }
+            if (nextFile < filesToLoad.size() && maxStrainsAhead == 0) {
+                fileToLoad = filesToLoad[nextFile++];
+                nbFilesLoading++;
+                return true;
+            }
+            if (nextFile == filesToLoad.size() && nbFilesLoading == 0)
+                return false;
+            //some file is being loaded: wait for its chunks
+            workAvailable.wait(lock);
+        }
+    }
+
+    //for the reader threads: blocks until fewer than maxStrainsAhead loaded strains are waiting, and returns
+    //the index of the next file to load (which must then be given back with push()), or -1 when all are loaded
+    //or when the queue was stopped
+    int nextFileToRead() {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (!stopped && nextFile < filesToLoad.size() && nbStrainsQueued + nbFilesLoading >= maxStrainsAhead)
+            readSlotAvailable.wait(lock);
+        if (stopped || nextFile == filesToLoad.size())
+            return -1;
+        nbFilesLoading++;
+        return filesToLoad[nextFile++];
+    }
+
+    //gives the chunks of a loaded file
+    void push(std::vector<SequenceChunk> &fileChunks) {
+        std::lock_guard<std::mutex> lock(mutex);
+        chunks.insert(chunks.end(), fileChunks.begin(), fileChunks.end());
+        nbFilesLoading--;
+        if (!fileChunks.empty())
+            nbStrainsQueued++;
+        else
+            readSlotAvailable.notify_one();
+        workAvailable.notify_all();
+    }
+
+    //after a failure: all threads waiting or asking for work are told there is none left
+    void stop() {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopped = true;
+        workAvailable.notify_all();
+        readSlotAvailable.notify_all();
+    }
+
+private:
+    std::vector<int> filesToLoad;
+    size_t nextFile;
+    size_t nbFilesLoading;
+    size_t maxStrainsAhead, nbStrainsQueued;
+    bool stopped;
+    std::deque<SequenceChunk> chunks;
+    std::mutex mutex;
+    std::condition_variable workAvailable, readSlotAvailable;
+};
+
+#endif //_CHUNKQUEUE_H
@@ -31,6 +31,10 @@
 #include <functional>
 
 #include <set>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <limits>
 #include <stdlib.h> // for exit()
 #include <iostream>
 #include <fstream>
@@ -40,6 +44,8 @@
 #include <boost/regex.hpp>
 #include <assert.h>
 #include <gatb/gatb_core.hpp>
+#include "KmerStreamer.h"
+#include "UnitigArena.h"
 
 
 #ifndef _GRAPHOUTPUT_H
@@ -47,21 +53,33 @@
 
 using namespace std;
 
+//number of unitigs whose edges are computed by a thread at a time
+#define GRAPH_OUTPUT_BLOCK_SIZE 10000
+
 template<size_t span>
 class GraphOutput {
  private:
-    typedef typename Kmer<span>::ModelCanonical ModelCanonical;
+    typedef typename Kmer<span>::Type Type;
     FILE *nodes_file,*edges_file;
     Graph *graph;
     string prefix;
+    int nbCores;
+    size_t kmerSize;
+    Type kMinus1_merMask;
 
     enum LeftOrRight { LEFT=0, RIGHT=1 };
+
+    //a leftest or rightest (k-1)-mer of a unitig: its canonical value, the unitig id, the strand of the (k-1)-mer, and its side
     struct kMinus1_MerInfo {
+        Type kMinus1_mer;
         long node;
-        Strand strand;
         LeftOrRight left_or_right;
-        kMinus1_MerInfo(long node, Strand strand, LeftOrRight left_or_right) : node(node), strand(strand), left_or_right(left_or_right) {}
+        Strand strand;
+        kMinus1_MerInfo(const Type &kMinus1_mer, long node, Strand strand, LeftOrRight left_or_right) :
+            kMinus1_mer(kMinus1_mer), node(node), left_or_right(left_or_right), strand(strand) {}
         bool operator<(const kMinus1_MerInfo &other) const {
+            if (kMinus1_mer != other.kMinus1_mer)
+                return kMinus1_mer < other.kMinus1_mer;
             if (node != other.node)
                 return (node < other.node);
             if (left_or_right != other.left_or_right)
@@ -70,18 +88,100 @@ class GraphOutput {
         }
     };
 
+    //kMinus1_MerLinks has all the leftest and rightest (k-1)-mers of the unitigs, sorted, so that the unitigs sharing
+    //a (k-1)-mer are contiguous
+    vector<kMinus1_MerInfo> kMinus1_MerLinks;
 
-    //kMinus1_MerLinks maps the kmer to its unitig id, strand, and if it is the leftest or the rightest kmer of the unitig
-    struct CompareKmerCanonical {
-      bool operator() (const typename gatb::core::kmer::impl::Kmer<span>::KmerCanonical& lhs,
-                       const typename gatb::core::kmer::impl::Kmer<span>::KmerCanonical& rhs) const {
-        return lhs.value() < rhs.value();
-      }
-    };
-    map<typename ModelCanonical::Kmer,set<kMinus1_MerInfo>,CompareKmerCanonical > kMinus1_MerLinks;
+    //firstAndLastKmers stores the first and the last kmers of a unitig, as read on the unitig (i.e. not canonical)
+    vector< pair<Type, Type> > firstAndLastKmers;
+
+    //2-bit encoding (GATB's) of a sequence, the first base in the highest bits
+    static Type encode(const char *sequence, size_t length) {
+        Type value = Type(0);
+        for (size_t i = 0; i < length; i++)
+            value = (value << 2) | Type(KMER_STREAMER_NT_CODE[(unsigned char)sequence[i]]);
+        return value;
+    }
+
+    //canonical value and strand of a (k-1)-mer, as GATB's KmerCanonical gives them
+    pair<Type, Strand> canonical(const Type &kMinus1_mer) const {
+        Type reverse = revcomp(kMinus1_mer, kmerSize-1);
+        if (kMinus1_mer < reverse)
+            return make_pair(kMinus1_mer, STRAND_FORWARD);
+        return make_pair(reverse, STRAND_REVCOMP);
+    }
+
+    //the kmer to is a successor of the kmer from if they overlap by k-1 bases (both are unitig extremities, so are in the graph)
+    bool isEdge(const Type &from, const Type &to) const {
+        return (from & kMinus1_merMask) == (to >> 2);
+    }
+
+    //the (k-1)-mer links of a (k-1)-mer
+    pair<typename vector<kMinus1_MerInfo>::const_iterator, typename vector<kMinus1_MerInfo>::const_iterator>
+    getLinks(const Type &kMinus1_mer) const {
+        auto begin = lower_bound(kMinus1_MerLinks.begin(), kMinus1_MerLinks.end(),
+                                 kMinus1_MerInfo(kMinus1_mer, numeric_limits<long>::min(), STRAND_FORWARD, LEFT));
+        auto end = begin;
+        while (end != kMinus1_MerLinks.end() && end->kMinus1_mer == kMinus1_mer)
+            ++end;
+        return make_pair(begin, end);
+    }
+
+    void append_edge(string &edges, long id, long id2, const char *label) const {
+        edges += to_string(id);
+        edges += '\t';
+        edges += to_string(id2);
+        edges += '\t';
+        edges += label;
+        edges += '\n';
+    }
+
+    //appends the edges of the unitig idNodes to edges, in the same order as they would be found walking the
+    //links of its left, then right, (k-1)-mers
+    void construct_edges(long idNodes, string &edges) const {
+        const Type &leftNode = firstAndLastKmers[idNodes].first;
+        const Type &rightNode = firstAndLastKmers[idNodes].second;
+
+        // left edges (are revcomp extensions)
+        // get the nodes that has a left kmer or right kmer identical to the leftest (k-1)-mer
+        {
+            auto leftkMinus1_mer = canonical(leftNode >> 2);
+            Type leftNodeReversed = revcomp(leftNode, kmerSize);
+            auto links = getLinks(leftkMinus1_mer.first);
+            for (auto it = links.first; it != links.second; ++it) {
+                if (it->node == idNodes) // prevent self loops on same kmer
+                    continue;
+
+                if (it->left_or_right == LEFT) {
+                    if (it->strand != leftkMinus1_mer.second && isEdge(leftNodeReversed, firstAndLastKmers[it->node].first))
+                        append_edge(edges, idNodes, it->node, "RF");
+                }
+                else {
+                    if (it->strand == leftkMinus1_mer.second && isEdge(leftNodeReversed, revcomp(firstAndLastKmers[it->node].second, kmerSize)))
+                        append_edge(edges, idNodes, it->node, "RR");
+                }
+            }
+        }
 
-    //firstAndLastKmers stores the first and the last kmers of a unitig
-    vector< pair<typename ModelCanonical::Kmer, typename ModelCanonical::Kmer> > firstAndLastKmers;
+        // right edges
+        {
+            auto rightkMinus1_mer = canonical(rightNode & kMinus1_merMask);
+            auto links = getLinks(rightkMinus1_mer.first);
+            for (auto it = links.first; it != links.second; ++it) {
+                if (it->node == idNodes) // prevent self loops on same kmer
+                    continue;
+
+                if (it->left_or_right == LEFT) {
+                    if (it->strand == rightkMinus1_mer.second && isEdge(rightNode, firstAndLastKmers[it->node].first))
+                        append_edge(edges, idNodes, it->node, "FF");
+                }
+                else {
+                    if (it->strand != rightkMinus1_mer.second && isEdge(rightNode, revcomp(firstAndLastKmers[it->node].second, kmerSize)))
+                        append_edge(edges, idNodes, it->node, "FR");
+                }
+            }
+        }
+    }
 
 
 public:
@@ -89,7 +189,10 @@ public:
     /*    Initialize first elements and files  (files are erasing)            */
     /*                              */
     /************************************************************************************************************************/
-    GraphOutput(Graph *graph=NULL, const string &prefix="graph") : graph(graph), prefix(prefix){}
+    GraphOutput(Graph *graph=NULL, const string &prefix="graph", int nbCores=0) : graph(graph), prefix(prefix), nbCores(nbCores) {
+        kmerSize = graph == NULL ? 1 : graph->getKmerSize();
+        kMinus1_merMask = (Type(1) << (2*(kmerSize-1))) - Type(1);
+    }
 
     void open(){
         string nodes_file_name=(prefix+".nodes");
@@ -103,64 +206,31 @@ public:
         fclose(edges_file);
     }
 
-    /************************************************************************************************************************/
-    /*      output a single node to a file                                      */
-    /*                                                          */
-    /************************************************************************************************************************/
-    void print_node(long index, char *ascii_node) // output a single node to a file
-    {
-        fprintf(nodes_file,"%ld\t%s\n",index,ascii_node);
-    }
-
-
-    /************************************************************************************************************************/
-    /*      output a single edges to a file                                     */
-    /*                                                          */
-    /************************************************************************************************************************/
-    void print_edge(long index, long id, long id2, string label)
-    {
-        fprintf(edges_file,"%ld\t%ld\t%s\n",id,id2,label.c_str());
-    }
-
     /************************************************************************************************************************/
     /*      load nodes extremities                                          */
     /*                                                          */
     /************************************************************************************************************************/
-    //function that goes through the unitig file and populates kMinus1_MerLinks
-    //kMinus1_MerLinks stores as key a (k-1)-mer and as value the (k-1)-mer's unitig id, strand, and if it is the leftest or the rightest (k-1)-mer of the unitig (this for all unitigs. So, if a (k-1)-mer appears as leftest or rightest in n unitigs, we will have one entry and n values)
-    //kMinus1_MerLinks stores all the leftest and rightest kmers of each unitig
-    void load_nodes_extremities(const string &linear_seqs_name)
+    //function that goes through the unitigs and populates kMinus1_MerLinks
+    //kMinus1_MerLinks stores the leftest and rightest (k-1)-mers of all unitigs, with the (k-1)-mer's unitig id, strand, and if it is the leftest or the rightest (k-1)-mer of the unitig
+    //(so, if a (k-1)-mer appears as leftest or rightest in n unitigs, we will have n contiguous entries)
+    void load_nodes_extremities(const UnitigArena &unitigs)
     {
-        IBank *Nodes = Bank::open((char *)linear_seqs_name.c_str());
-        LOCAL (Nodes);
-
-        long nb_nodes = 0;
-
-        // We loop over sequences.
-        // for each node, output all the out-edges (in-edges will correspond to out-edges of neighbors)
-        ProgressIterator<Sequence> it(*Nodes, "Loading endpoints of unitigs");
-        ModelCanonical kMinus1_merModel(graph->getKmerSize()-1);
-        ModelCanonical k_merModel(graph->getKmerSize());
-        for (it.first(); !it.isDone(); it.next()) {
-            string sequence = it.item().toString();
-
-            //here we get the left and the right (k-1)-mer of the unitigs, reverse and forward, and code them
-            typename ModelCanonical::Kmer leftkMinus1_mer, rightkMinus1_mer, leftk_mer, rightk_mer;
-
-            //code kmers (the canonical (minimum between fw and rc will be saved))
-            leftkMinus1_mer = kMinus1_merModel.codeSeed(sequence.c_str(), Data::ASCII, 0);
-            leftk_mer = k_merModel.codeSeed(sequence.c_str(), Data::ASCII, 0);
-            rightkMinus1_mer = kMinus1_merModel.codeSeed(sequence.c_str(), Data::ASCII, sequence.length()-(graph->getKmerSize()-1));
-            rightk_mer = k_merModel.codeSeed(sequence.c_str(), Data::ASCII, sequence.length()-graph->getKmerSize());
-
-            //kMinus1_MerLinks maps the kmer to its unitig id, strand, and if it is the leftest or the rightest kmer of the unitig
-            kMinus1_MerLinks[leftkMinus1_mer].insert(kMinus1_MerInfo(nb_nodes, leftkMinus1_mer.strand(), LEFT));
-            kMinus1_MerLinks[rightkMinus1_mer].insert(kMinus1_MerInfo(nb_nodes, rightkMinus1_mer.strand(), RIGHT));
+        kMinus1_MerLinks.reserve(2 * unitigs.getNbUnitigs());
+        firstAndLastKmers.reserve(unitigs.getNbUnitigs());
+        for (long nb_nodes = 0; nb_nodes < (long)unitigs.getNbUnitigs(); nb_nodes++) {
+            //here we get the left and the right kmers of the unitigs, and their (k-1)-mers
+            Type leftk_mer = unitigs.encode<Type>(nb_nodes, 0, kmerSize);
+            Type rightk_mer = unitigs.encode<Type>(nb_nodes, unitigs.getLength(nb_nodes) - kmerSize, kmerSize);
+            auto leftkMinus1_mer = canonical(leftk_mer >> 2);
+            auto rightkMinus1_mer = canonical(rightk_mer & kMinus1_merMask);
+
+            kMinus1_MerLinks.push_back(kMinus1_MerInfo(leftkMinus1_mer.first, nb_nodes, leftkMinus1_mer.second, LEFT));
+            kMinus1_MerLinks.push_back(kMinus1_MerInfo(rightkMinus1_mer.first, nb_nodes, rightkMinus1_mer.second, RIGHT));
 
             firstAndLastKmers.push_back(make_pair(leftk_mer, rightk_mer));
-
-            nb_nodes++;
         }
+
+        sort(kMinus1_MerLinks.begin(), kMinus1_MerLinks.end());
     }
 
 
@@ -168,198 +238,42 @@ public:
     /*      construct node file and edge file for graph file                                                                */
     /*                                                                                                                      */
     /************************************************************************************************************************/
-    void construct_graph(string linear_seqs_name)
+    //the nodes and edges of blocks of GRAPH_OUTPUT_BLOCK_SIZE unitigs are computed by nbCores threads, and written in the unitig order
+    void construct_graph(const UnitigArena &unitigs)
     {
-        IBank *Nodes = Bank::open(linear_seqs_name);
-        LOCAL (Nodes);
-        long idNodes=0;
-        long idEdges=0;
+        Dispatcher dispatcher(nbCores);
+        long nbBlocksPerWave = 4 * dispatcher.getExecutionUnitsNumber();
+        long nbUnitigs = unitigs.getNbUnitigs();
+        vector<string> nodes(nbBlocksPerWave), edges(nbBlocksPerWave);
 
-        // We loop over sequences.
+        // We loop over the unitigs, a wave of blocks at a time.
         // for each node, output all the out-edges (in-edges will correspond to out-edges of neighbors)
-        ProgressIterator<Sequence> it(*Nodes, "Building .nodes and .edges files");
-        ModelCanonical kMinus1_merModel(graph->getKmerSize()-1);
-        ModelCanonical k_merModel(graph->getKmerSize());
-        int index=0;
-        for (it.first(); !it.isDone(); it.next(), index++)
-        {
-            string sequence = it.item().toString();
-
-            typename ModelCanonical::Kmer leftkMinus1_mer, rightkMinus1_mer;
-
-            //code kmers (the canonical (minimum between fw and rc will be saved))
-            leftkMinus1_mer = kMinus1_merModel.codeSeed(sequence.c_str(), Data::ASCII, 0);
-            Node leftNode = graph->buildNode(k_merModel.toString(firstAndLastKmers[index].first.value()).c_str());
-
-            if (firstAndLastKmers[index].first.strand() != leftNode.strand)
-                leftNode = graph->reverse(leftNode);
-
-            rightkMinus1_mer = kMinus1_merModel.codeSeed(sequence.c_str(), Data::ASCII, sequence.length()-(graph->getKmerSize()-1));
-            Node rightNode = graph->buildNode(k_merModel.toString(firstAndLastKmers[index].second.value()).c_str());
-            if (firstAndLastKmers[index].second.strand() != rightNode.strand)
-                rightNode = graph->reverse(rightNode);
-
-            // left edges (are revcomp extensions)
-            // get the nodes that has a left kmer or right kmer identical to the kmer stored in leftkMinus1_mer
-            typename set<kMinus1_MerInfo>::iterator it;
-            for (it = kMinus1_MerLinks[leftkMinus1_mer].begin(); it != kMinus1_MerLinks[leftkMinus1_mer].end(); it++)
-            {
-                long cur_node = it->node;
-                Strand cur_strand = it->strand;
-                LeftOrRight cur_left_or_right = it->left_or_right;
-
-                //build the node correctly
-                Node cur_GATB_node;
-                if (cur_left_or_right==LEFT) {
-                    cur_GATB_node = graph->buildNode(k_merModel.toString(firstAndLastKmers[cur_node].first.value()).c_str());
-                    if (firstAndLastKmers[cur_node].first.strand() != cur_GATB_node.strand)
-                        cur_GATB_node = graph->reverse(cur_GATB_node);
-                }else {
-                    cur_GATB_node = graph->buildNode(k_merModel.toString(firstAndLastKmers[cur_node].second.value()).c_str());
-                    if (firstAndLastKmers[cur_node].second.strand() != cur_GATB_node.strand)
-                        cur_GATB_node = graph->reverse(cur_GATB_node);
-                }
-
-
-                /* TODO
-                 * I do not understand this well...
-                if (cur_node ==nb_els.node) // prevent self loops on same kmer
-                     if (sequence.length() == sizeKmer)
-                        continue;
-                */
-                //Replaced the preceding by:
-                if (cur_node ==idNodes) // prevent self loops on same kmer
-                    continue;
-
-                string label = "R";
-
-                if (cur_left_or_right == LEFT)
-                {
-                    if (cur_strand != leftkMinus1_mer.strand())
-                        label+=(string)"F";
-                    else
-                        continue;
-                }
-                else
-                {
-                    if (cur_strand == leftkMinus1_mer.strand())
-                        label+=(string)"R";
-                    else
-                        continue;
-                }
-
-
-                //fix the strands
-                Node leftNodeCorrected=leftNode;
-                if (label[0]=='R')
-                    leftNodeCorrected = graph->reverse(leftNodeCorrected);
-                if (label[1]=='R')
-                    cur_GATB_node = graph->reverse(cur_GATB_node);
-
-                //check if this edge exist in the graph (maybe it was removed in the sequencing-error removal step)
-                vector<Node> neighbours;
-                //cout << "Neighbours: " << endl;
-                graph->successors(leftNodeCorrected).iterate([&](const Node &node) {
-                    neighbours.push_back(node);
-                    //cout << graph->toString(node) << endl;
-                });
-                if (find(neighbours.begin(), neighbours.end(), cur_GATB_node) != neighbours.end()) {
-                    print_edge(idEdges, idNodes, cur_node, label);
-                    idEdges++;
-                }
-                else {
-                    //DEBUG
-                    /*
-                    string curGATBNodeAsStr=graph->toString(cur_GATB_node);
-                    cout << "Edge skipped LEFT: [" <<
-                            graph->toString(leftNodeCorrected) << " --" << (*(curGATBNodeAsStr.rbegin())) <<"--> " << curGATBNodeAsStr << "]" << endl;
-                    */
-                    //DEBUG
+        cout << "Building .nodes and .edges files" << endl;
+        for (long waveStart = 0; waveStart < nbUnitigs; waveStart += nbBlocksPerWave * GRAPH_OUTPUT_BLOCK_SIZE) {
+            long waveEnd = min<long>(nbUnitigs, waveStart + nbBlocksPerWave * GRAPH_OUTPUT_BLOCK_SIZE);
+            int nbBlocks = (waveEnd - waveStart + GRAPH_OUTPUT_BLOCK_SIZE - 1) / GRAPH_OUTPUT_BLOCK_SIZE;
+            Range<int>::Iterator blocksIt(0, nbBlocks - 1);
+            dispatcher.iterate(blocksIt, [&](int block) {
+                nodes[block].clear();
+                edges[block].clear();
+                string sequence;
+                long end = min<long>(waveEnd, waveStart + (long)(block + 1) * GRAPH_OUTPUT_BLOCK_SIZE);
+                for (long id = waveStart + (long)block * GRAPH_OUTPUT_BLOCK_SIZE; id < end; id++) {
+                    unitigs.getSequence(id, sequence);
+                    nodes[block] += to_string(id);
+                    nodes[block] += '\t';
+                    nodes[block] += sequence;
+                    nodes[block] += '\n';
+                    construct_edges(id, edges[block]);
                 }
+            }, 1);
 
+            //and print the nodes and the edges, in order
+            for (int block = 0; block < nbBlocks; block++) {
+                fwrite(nodes[block].data(), 1, nodes[block].size(), nodes_file);
+                fwrite(edges[block].data(), 1, edges[block].size(), edges_file);
             }
-
-            // right edges
-            for (it = kMinus1_MerLinks[rightkMinus1_mer].begin(); it != kMinus1_MerLinks[rightkMinus1_mer].end(); it++)
-            {
-                long cur_node = it->node;
-                Strand cur_strand = it->strand;
-                LeftOrRight cur_left_or_right = it->left_or_right;
-
-                //build the node correctly
-                Node cur_GATB_node;
-                if (cur_left_or_right==LEFT) {
-                    cur_GATB_node = graph->buildNode(k_merModel.toString(firstAndLastKmers[cur_node].first.value()).c_str());
-                    if (firstAndLastKmers[cur_node].first.strand() != cur_GATB_node.strand)
-                        cur_GATB_node = graph->reverse(cur_GATB_node);
-                }else {
-                    cur_GATB_node = graph->buildNode(k_merModel.toString(firstAndLastKmers[cur_node].second.value()).c_str());
-                    if (firstAndLastKmers[cur_node].second.strand() != cur_GATB_node.strand)
-                        cur_GATB_node = graph->reverse(cur_GATB_node);
-                }
-
-                /* TODO
-                 * I do not understand this well...
-                if (cur_node ==nb_els.node) // prevent self loops on same kmer
-                     if (sequence.length() == sizeKmer)
-                        continue;
-                */
-                //Replaced the preceding by:
-                if (cur_node ==idNodes) // prevent self loops on same kmer
-                    continue;
-
-
-                string label = "F";
-                if (cur_left_or_right == LEFT)
-                {
-                    if (cur_strand == rightkMinus1_mer.strand())
-                        label+=(string)"F";
-                    else
-                        continue;
-                }
-                else
-                {
-                    if (cur_strand != rightkMinus1_mer.strand())
-                        label+=(string)"R";
-                    else
-                        continue;
-                }
-
-                //fix the strands
-                Node rightNodeCorrected=rightNode;
-                if (label[0]=='R')
-                    rightNodeCorrected = graph->reverse(rightNodeCorrected);
-                if (label[1]=='R')
-                    cur_GATB_node = graph->reverse(cur_GATB_node);
-
-                //check if this edge exist in the graph (maybe it was removed in the sequencing-error removal step)
-                vector<Node> neighbours;
-                //cout << "Neighbours: " << endl;
-                graph->successors(rightNodeCorrected).iterate([&](const Node &node) {
-                    neighbours.push_back(node);
-                    //cout << graph->toString(node) << endl;
-                });
-                if (find(neighbours.begin(), neighbours.end(), cur_GATB_node) != neighbours.end()) {
-                    print_edge(idEdges, idNodes, cur_node, label);
-                    idEdges++;
-                }
-                else {
-                    //DEBUG
-                    /*
-                    string curGATBNodeAsStr=graph->toString(cur_GATB_node);
-                    cout << "Edge skipped RIGHT: [" <<
-                    graph->toString(rightNodeCorrected) << " --" << (*(curGATBNodeAsStr.rbegin())) <<"--> " << curGATBNodeAsStr << "]" << endl;
-                     */
-                    //DEBUG
-                }
-            }
-            //print the node
-            print_node(idNodes, const_cast<char*>(sequence.c_str()));
-
-            //increase unitig id
-            idNodes++;
         }
     }
 };
 #endif //_GRAPHOUTPUT_H
-
@@ -0,0 +1,105 @@
+/*
+ * KmerStreamer.h
+ * Rolling 2-bit encoder producing the canonical GATB node of every k-mer of a sequence
+ *
+ * Each base updates the forward and reverse-complement k-mers in O(1), so
+ * a sequence of length n is encoded in O(n) without building any string.
+ * The encoding is GATB's (A=0, C=1, T=2, G=3), so the nodes built here hash
+ * to the same MPHF indexes as Graph::buildNode() would give.
+ *
+ */
+
+#ifndef _KMERSTREAMER_H
+#define _KMERSTREAMER_H
+
+#include <gatb/gatb_core.hpp>
+
+//GATB code of each ASCII character, or -1 for anything that is not ACGT (any case)
+//Kmers containing Ns (or any other IUPAC code, e.g. a 'K' in the fasta file) are not in any unitig:
+//GATB's buildNode() would silently turn them into some valid kmer, so these are skipped instead
+static const signed char KMER_STREAMER_NT_CODE[256] = {
+    -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1, -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+    -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1, -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+    -1, 0,-1, 1,-1,-1,-1, 3,-1,-1,-1,-1,-1,-1,-1,-1, -1,-1,-1,-1, 2,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+    -1, 0,-1, 1,-1,-1,-1, 3,-1,-1,-1,-1,-1,-1,-1,-1, -1,-1,-1,-1, 2,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+    -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1, -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+    -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1, -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+    -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1, -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+    -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1, -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1
+};
+
+template<size_t span>
+class KmerStreamer {
+public:
+    typedef typename Kmer<span>::Type Type;
+
+    KmerStreamer(size_t kmerSize) : kmerSize(kmerSize), read(NULL), readLength(0), pos(0), nbValidBases(0) {
+        kmerMask = (Type(1) << (2*kmerSize)) - Type(1);
+        revcompShift = 2*(kmerSize-1);
+    }
+
+    //starts streaming the kmers of read[0..readLength)
+    void reset(const char* read, size_t readLength) {
+        this->read = read;
+        this->readLength = readLength;
+        pos = 0;
+        nbValidBases = 0;
+    }
+
+    //advances to the next kmer made only of ACGT, jumping past any other base
+    //returns false when the end of the read is reached
+    bool next() {
+        while (pos < readLength) {
+            signed char code = KMER_STREAMER_NT_CODE[(unsigned char)read[pos++]];
+            if (code < 0) {
+                nbValidBases = 0;
+                continue;
+            }
+            forward = ((forward << 2) | Type(code)) & kmerMask;
+            revcomp = (revcomp >> 2) | (Type(code ^ 2) << revcompShift);
+            if (++nbValidBases >= kmerSize)
+                return true;
+        }
+        return false;
+    }
+
+    //moves the stream nbKmers kmers forward without reporting them, i.e. next() will then give the kmer
+    //starting at position()+nbKmers+1. The skipped bases are rolled in, or the kmer re-seeded if that is cheaper
+    //this must only skip over ACGT bases (e.g. bases known to follow a unitig)
+    void skip(size_t nbKmers) {
+        size_t target = pos + nbKmers;
+        if (nbKmers >= kmerSize) {
+            pos = target - kmerSize;
+            nbValidBases = 0;
+        }
+        while (pos < target) {
+            signed char code = KMER_STREAMER_NT_CODE[(unsigned char)read[pos++]];
+            forward = ((forward << 2) | Type(code)) & kmerMask;
+            revcomp = (revcomp >> 2) | (Type(code ^ 2) << revcompShift);
+            nbValidBases++;
+        }
+    }
+
+    //start of the current kmer in the read
+    size_t position() const { return pos - kmerSize; }
+
+    //the current kmer as a GATB node (canonical value + strand, as Graph::buildNode() does)
+    Node node() const {
+        if (forward < revcomp)
+            return Node(Node::Value(forward), STRAND_FORWARD);
+        else
+            return Node(Node::Value(revcomp), STRAND_REVCOMP);
+    }
+
+private:
+    size_t kmerSize;
+    Type kmerMask;
+    size_t revcompShift;
+    Type forward, revcomp;
+    const char* read;
+    size_t readLength;
+    size_t pos;
+    size_t nbValidBases;
+};
+
+#endif //_KMERSTREAMER_H
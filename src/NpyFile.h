@@ -0,0 +1,80 @@
+/*
+ * NpyFile.h
+ * Writer of a 1 or 2 dimensional array in numpy's .npy format, streamed row by row
+ *
+ * The .npy format is a short text header describing the array (type, order, shape)
+ * followed by the raw data, so the files can be mapped in memory with numpy.load(...,
+ * mmap_mode='r') or read by any tool. The number of rows is only known when the file is
+ * closed: the header is written with a fixed size and rewritten on close.
+ *
+ * close() must be called for the file to be complete (a write error is then fatal): the
+ * destructor only closes a file left open, which keeps its header of 0 rows.
+ *
+ */
+
+#ifndef _NPYFILE_H
+#define _NPYFILE_H
+
+#include <string>
+#include <cstdio>
+#include <sys/types.h>
+#include "Utils.h"
+
+#define NPY_HEADER_SIZE 128 //fixed size of the header (magic, version, length and padded dict), a multiple of 64
+
+class NpyFile {
+public:
+    //descr: numpy type of the elements (e.g. "|u1", "<u4", "<u8"); nbColumns: 0 for a 1 dimensional array
+    NpyFile(const std::string &filename, const std::string &descr, u_int64_t nbColumns = 0) :
+        filename(filename), descr(descr), nbColumns(nbColumns), nbRows(0) {
+        file = fopen(filename.c_str(), "wb");
+        if (file == NULL)
+            fatalError("Could not open file " + filename + " for writing");
+        writeHeader();
+    }
+
+    ~NpyFile() {
+        if (file != NULL)
+            fclose(file);
+    }
+
+    //appends nbRows rows (elements, for a 1 dimensional array) of data
+    void write(const void *data, size_t size, u_int64_t nbRowsWritten) {
+        if (size > 0 && fwrite(data, 1, size, file) != size)
+            fatalError("Could not write to file " + filename + " (disk full?)");
+        nbRows += nbRowsWritten;
+    }
+
+    void close() {
+        if (file == NULL)
+            return;
+        if (fseek(file, 0, SEEK_SET) != 0)
+            fatalError("Could not seek in file " + filename);
+        writeHeader();
+        int closed = fclose(file);
+        file = NULL;
+        if (closed != 0)
+            fatalError("Could not write to file " + filename + " (disk full?)");
+    }
+
+private:
+    void writeHeader() {
+        std::string dict = "{'descr': '" + descr + "', 'fortran_order': False, 'shape': (" + std::to_string(nbRows) +
+                           (nbColumns > 0 ? ", " + std::to_string(nbColumns) + "), }" : ",), }");
+        std::string header("\x93NUMPY\x01\x00", 8);
+        u_int16_t dictSize = NPY_HEADER_SIZE - 10;
+        header += (char)(dictSize & 0xff);
+        header += (char)(dictSize >> 8);
+        header += dict;
+        header.resize(NPY_HEADER_SIZE - 1, ' ');
+        header += '\n';
+        if (fwrite(header.data(), 1, header.size(), file) != header.size())
+            fatalError("Could not write to file " + filename + " (disk full?)");
+    }
+
+    std::string filename, descr;
+    u_int64_t nbColumns, nbRows;
+    FILE *file;
+};
+
+#endif //_NPYFILE_H
@@ -0,0 +1,99 @@
+/*
+ * ProgressReporter.cpp
+ * Progress of the mapping, counted by the threads without locking and reported by a thread of its own
+ *
+ */
+
+#include "ProgressReporter.h"
+#include "RunStats.h"
+#include <cstdio>
+#include <iostream>
+#include <fstream>
+
+using namespace std;
+
+ProgressReporter::ProgressReporter(int nbThreads, u_int64_t nbStrains, double intervalSeconds, const string &metricsFilename) :
+    nbThreads(nbThreads), counters(new ProgressCounters[nbThreads]), nbStrains(nbStrains), intervalSeconds(intervalSeconds), metricsFilename(metricsFilename), stopping(false) {
+    lastReport.reads = lastReport.kmers = lastReport.strains = 0;
+}
+
+ProgressReporter::Totals ProgressReporter::getTotals() const {
+    Totals totals;
+    totals.reads = totals.kmers = totals.strains = 0;
+    for (int i = 0; i < nbThreads; i++) {
+        const ProgressCounters &threadCounters = counters[i];
+        totals.reads += threadCounters.reads.load(memory_order_relaxed);
+        totals.kmers += threadCounters.kmers.load(memory_order_relaxed);
+        totals.strains += threadCounters.strains.load(memory_order_relaxed);
+    }
+    return totals;
+}
+
+void ProgressReporter::start() {
+    startTime = lastReportTime = chrono::steady_clock::now();
+    if (intervalSeconds > 0)
+        reporter = thread(&ProgressReporter::run, this);
+}
+
+void ProgressReporter::stop() {
+    if (!reporter.joinable())
+        return;
+    {
+        lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    stopRequested.notify_one();
+    reporter.join();
+    report(true);
+}
+
+void ProgressReporter::run() {
+    unique_lock<std::mutex> lock(mutex);
+    while (!stopRequested.wait_for(lock, chrono::duration<double>(intervalSeconds), [this]() { return stopping; }))
+        report(false);
+}
+
+void ProgressReporter::report(bool done) {
+    auto now = chrono::steady_clock::now();
+    double elapsed = chrono::duration<double>(now - startTime).count();
+    double sinceLast = chrono::duration<double>(now - lastReportTime).count();
+    Totals totals = getTotals();
+
+    //the rates are those of the last interval, and the time left is extrapolated from the average rate of the strains
+    double readsPerSecond = sinceLast > 0 ? (totals.reads - lastReport.reads) / sinceLast : 0;
+    double kmersPerSecond = sinceLast > 0 ? (totals.kmers - lastReport.kmers) / sinceLast : 0;
+    double etaSeconds = -1;
+    if (done)
+        etaSeconds = 0;
+    else if (totals.strains > 0)
+        etaSeconds = elapsed * (nbStrains - totals.strains) / totals.strains;
+    lastReport = totals;
+    lastReportTime = now;
+
+    char line[256];
+    snprintf(line, sizeof(line), "%llu/%llu strains mapped, %.0f reads/s, %.3g kmers/s, elapsed %.0f s, ETA %s",
+             (unsigned long long)totals.strains, (unsigned long long)nbStrains, readsPerSecond, kmersPerSecond, elapsed,
+             etaSeconds < 0 ? "unknown" : (to_string((long long)etaSeconds) + " s").c_str());
+    cout << line << endl;
+
+    if (metricsFilename.empty())
+        return;
+    string partFilename = metricsFilename + ".part";
+    {
+        ofstream metricsFile(partFilename);
+        if (!metricsFile)
+            return; //the progress is not worth stopping the run
+        char times[128];
+        snprintf(times, sizeof(times), "\"elapsed_seconds\": %.3f,\n  \"eta_seconds\": %.0f,\n", elapsed, etaSeconds);
+        metricsFile << "{\n  \"stage\": \"mapping\",\n  \"done\": " << (done ? "true" : "false") << ",\n"
+                    << "  \"strains_done\": " << totals.strains << ",\n"
+                    << "  \"strains_total\": " << nbStrains << ",\n"
+                    << "  \"reads\": " << totals.reads << ",\n"
+                    << "  \"kmers\": " << totals.kmers << ",\n"
+                    << "  \"reads_per_second\": " << (u_int64_t)readsPerSecond << ",\n"
+                    << "  \"kmers_per_second\": " << (u_int64_t)kmersPerSecond << ",\n"
+                    << "  " << times
+                    << "  \"rss_bytes\": " << ResourceUsage::now().rss << "\n}\n";
+    }
+    rename(partFilename.c_str(), metricsFilename.c_str());
+}
@@ -0,0 +1,87 @@
+/*
+ * ProgressReporter.h
+ * Progress of the mapping, counted by the threads without locking and reported by a thread of its own
+ *
+ * Each thread adds what it processed to its own counters (relaxed atomics, aligned on a
+ * cache line so that the threads do not share them), so it never waits on the progress.
+ * Every interval, the reporter thread sums them, prints a line with the throughput
+ * (reads/s, kmers/s), the strains done and the estimated time left, and rewrites a small
+ * JSON metrics file (written aside then renamed, so that a job scheduler polling it never
+ * reads it half written).
+ *
+ */
+
+#ifndef _PROGRESSREPORTER_H
+#define _PROGRESSREPORTER_H
+
+#include <string>
+#include <memory>
+#include <new>
+#include <cstdlib>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <sys/types.h>
+
+//the counters of a thread, only written by it (hence the plain load and store, no locked instruction)
+struct alignas(64) ProgressCounters {
+    std::atomic<u_int64_t> reads, kmers, strains;
+
+    ProgressCounters() : reads(0), kmers(0), strains(0) {}
+
+    //the default allocation only guarantees 16 bytes alignment before C++17
+    static void* operator new[](size_t size) {
+        void *memory;
+        if (posix_memalign(&memory, alignof(ProgressCounters), size) != 0)
+            throw std::bad_alloc();
+        return memory;
+    }
+    static void operator delete[](void *memory) { free(memory); }
+
+    void add(std::atomic<u_int64_t> &counter, u_int64_t value) {
+        counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+    }
+};
+
+class ProgressReporter {
+public:
+    //counters for nbThreads threads, out of nbStrains strains to map
+    //reports every intervalSeconds (not at all if 0) to the standard output and to metricsFilename (if not empty)
+    ProgressReporter(int nbThreads, u_int64_t nbStrains, double intervalSeconds, const std::string &metricsFilename);
+    ~ProgressReporter() { stop(); }
+
+    ProgressCounters& getCounters(int threadId) { return counters[threadId]; }
+
+    //the totals of the threads
+    struct Totals {
+        u_int64_t reads, kmers, strains;
+    };
+    Totals getTotals() const;
+
+    //starts the reporter thread
+    void start();
+    //stops the reporter thread, after a last report
+    void stop();
+
+private:
+    int nbThreads;
+    std::unique_ptr<ProgressCounters[]> counters;
+    u_int64_t nbStrains;
+    double intervalSeconds;
+    std::string metricsFilename;
+
+    std::thread reporter;
+    std::mutex mutex;
+    std::condition_variable stopRequested;
+    bool stopping;
+
+    std::chrono::steady_clock::time_point startTime, lastReportTime;
+    Totals lastReport;
+
+    void run();
+    void report(bool done);
+};
+
+#endif //_PROGRESSREPORTER_H
@@ -0,0 +1,164 @@
+/*
+ * RunStats.cpp
+ * Measure of the resources used by the stages of a run
+ *
+ */
+
+#include "RunStats.h"
+#include "Utils.h"
+#include "version.h"
+#include <chrono>
+#include <cstdio>
+#include <mutex>
+#include <algorithm>
+#include <sys/resource.h>
+#include <unistd.h>
+
+using namespace std;
+
+//the wall time is counted from the first measure (at the start of the run)
+static const chrono::steady_clock::time_point processStart = chrono::steady_clock::now();
+
+//the marks read so far: as resetting the high-water mark also resets ru_maxrss, the peak of the process is kept here,
+//and the stages still running keep theirs (the progress is measured by a thread of its own, hence the lock)
+static mutex peakMutex;
+static u_int64_t processPeakRss = 0;
+static vector<u_int64_t*>& getRunningStagePeaks() {
+    static vector<u_int64_t*> runningStagePeaks;
+    return runningStagePeaks;
+}
+
+//the high-water mark of the resident memory since it was last reset (or since the start)
+static u_int64_t readPeakRss(const struct rusage &rusage) {
+    if (FILE *status = fopen("/proc/self/status", "r")) {
+        char line[256];
+        unsigned long long kilobytes;
+        while (fgets(line, sizeof(line), status)) {
+            if (sscanf(line, "VmHWM: %llu kB", &kilobytes) == 1) {
+                fclose(status);
+                return (u_int64_t)kilobytes * 1024;
+            }
+        }
+        fclose(status);
+    }
+    return (u_int64_t)rusage.ru_maxrss * 1024;
+}
+
+//lowers the high-water mark to the current resident memory, returns false if it cannot be done
+static bool resetPeakRss() {
+    FILE *clearRefs = fopen("/proc/self/clear_refs", "w");
+    if (clearRefs == NULL)
+        return false;
+    bool reset = fputs("5", clearRefs) >= 0;
+    return fclose(clearRefs) == 0 && reset;
+}
+
+//reads the mark and keeps it for the process and the running stages (peakMutex locked)
+static u_int64_t recordPeakRss(const struct rusage &rusage) {
+    u_int64_t peakRss = readPeakRss(rusage);
+    processPeakRss = max(processPeakRss, peakRss);
+    for (u_int64_t *stagePeakRss : getRunningStagePeaks())
+        *stagePeakRss = max(*stagePeakRss, peakRss);
+    return processPeakRss;
+}
+
+ResourceUsage ResourceUsage::now() {
+    ResourceUsage usage;
+    usage.wallSeconds = chrono::duration<double>(chrono::steady_clock::now() - processStart).count();
+
+    struct rusage rusage;
+    getrusage(RUSAGE_SELF, &rusage);
+    usage.cpuSeconds = rusage.ru_utime.tv_sec + rusage.ru_stime.tv_sec + (rusage.ru_utime.tv_usec + rusage.ru_stime.tv_usec) / 1e6;
+    {
+        lock_guard<mutex> lock(peakMutex);
+        usage.peakRss = recordPeakRss(rusage);
+    }
+
+    //current memory and IO are only known on Linux (they are 0 elsewhere)
+    usage.rss = usage.bytesRead = usage.bytesWritten = 0;
+    if (FILE *statm = fopen("/proc/self/statm", "r")) {
+        unsigned long long size, resident;
+        if (fscanf(statm, "%llu %llu", &size, &resident) == 2)
+            usage.rss = resident * sysconf(_SC_PAGESIZE);
+        fclose(statm);
+    }
+    if (FILE *io = fopen("/proc/self/io", "r")) {
+        char key[64];
+        unsigned long long value;
+        while (fscanf(io, "%63[^:]: %llu\n", key, &value) == 2) {
+            if (string(key) == "rchar")
+                usage.bytesRead = value;
+            else if (string(key) == "wchar")
+                usage.bytesWritten = value;
+        }
+        fclose(io);
+    }
+    return usage;
+}
+
+RunStage::RunStage(const string &name) : name(name), start(ResourceUsage::now()), peakRss(0), stopped(false) {
+    //the mark read by now() is kept for the stages already running, so that it can be reset for this one
+    lock_guard<mutex> lock(peakMutex);
+    if (!resetPeakRss())
+        peakRss = start.peakRss;
+    getRunningStagePeaks().push_back(&peakRss);
+}
+
+void RunStage::stop() {
+    if (stopped)
+        return;
+    stopped = true;
+    RunStats::Stage stage;
+    stage.name = name;
+    stage.start = start;
+    stage.end = ResourceUsage::now();
+    {
+        lock_guard<mutex> lock(peakMutex);
+        vector<u_int64_t*> &runningStagePeaks = getRunningStagePeaks();
+        runningStagePeaks.erase(find(runningStagePeaks.begin(), runningStagePeaks.end(), &peakRss));
+    }
+    stage.peakRss = peakRss;
+    stage.counts = counts;
+    RunStats::getStages().push_back(stage);
+}
+
+vector<RunStats::Stage>& RunStats::getStages() {
+    static vector<Stage> stages;
+    return stages;
+}
+
+//the usage between start and end (with a peak of peakRss), as the members of a JSON object
+static void writeUsage(ostream &os, const ResourceUsage &start, const ResourceUsage &end, u_int64_t peakRss, const string &indent) {
+    char times[128];
+    snprintf(times, sizeof(times), "\"wall_seconds\": %.3f,\n%s\"cpu_seconds\": %.3f,\n", end.wallSeconds - start.wallSeconds,
+             indent.c_str(), end.cpuSeconds - start.cpuSeconds);
+    os << indent << times
+       << indent << "\"peak_rss_bytes\": " << peakRss << ",\n"
+       << indent << "\"rss_bytes\": " << end.rss << ",\n"
+       << indent << "\"bytes_read\": " << end.bytesRead - start.bytesRead << ",\n"
+       << indent << "\"bytes_written\": " << end.bytesWritten - start.bytesWritten;
+}
+
+void RunStats::save(const string &filename) {
+    ResourceUsage processStartUsage;
+    processStartUsage.wallSeconds = processStartUsage.cpuSeconds = 0;
+    processStartUsage.peakRss = processStartUsage.rss = processStartUsage.bytesRead = processStartUsage.bytesWritten = 0;
+
+    ofstream statsFile;
+    openFileForWriting(filename, statsFile);
+    statsFile << "{\n  \"version\": \"" << VERSION << "\",\n  \"stages\": [";
+    const vector<Stage> &stages = getStages();
+    for (size_t i = 0; i < stages.size(); i++) {
+        statsFile << (i == 0 ? "\n" : ",\n") << "    {\n      \"name\": \"" << stages[i].name << "\",\n";
+        writeUsage(statsFile, stages[i].start, stages[i].end, stages[i].peakRss, "      ");
+        statsFile << ",\n      \"counts\": {";
+        for (size_t j = 0; j < stages[i].counts.size(); j++)
+            statsFile << (j == 0 ? "" : ", ") << "\"" << stages[i].counts[j].first << "\": " << stages[i].counts[j].second;
+        statsFile << "}\n    }";
+    }
+    statsFile << "\n  ],\n  \"total\": {\n";
+    ResourceUsage processEndUsage = ResourceUsage::now();
+    writeUsage(statsFile, processStartUsage, processEndUsage, processEndUsage.peakRss, "    ");
+    statsFile << "\n  }\n}\n";
+    statsFile.close();
+}
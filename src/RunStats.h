@@ -0,0 +1,68 @@
+/*
+ * RunStats.h
+ * Resources used by each stage of a run, saved as JSON (run_stats.json in the output folder)
+ *
+ * A RunStage measures, from its creation until it is stopped (or destroyed), the wall and
+ * CPU time of the process, the bytes it read and wrote (rchar and wchar of /proc/self/io,
+ * so including what was served by the page cache), its peak resident memory and the
+ * resident memory at its end. Stages can also record counts of what they processed
+ * (kmers, unitigs, reads, patterns...). The stages are kept in the order they end.
+ *
+ * The peak of a stage is its own: the high-water mark of the process (VmHWM) is reset
+ * when a stage starts (by writing 5 to /proc/self/clear_refs) and read when it ends, the
+ * marks read in between being kept for the stages still running. Where it cannot be
+ * reset, the peak of a stage is that of the process so far.
+ *
+ */
+
+#ifndef _RUNSTATS_H
+#define _RUNSTATS_H
+
+#include <string>
+#include <vector>
+#include <utility>
+#include <sys/types.h>
+
+//resources used by the process so far (peakRss being the peak of the whole process)
+struct ResourceUsage {
+    double wallSeconds, cpuSeconds;
+    u_int64_t peakRss, rss, bytesRead, bytesWritten;
+
+    static ResourceUsage now();
+};
+
+class RunStage {
+public:
+    RunStage(const std::string &name);
+    ~RunStage() { stop(); }
+
+    void setCount(const std::string &countName, u_int64_t value) { counts.push_back(std::make_pair(countName, value)); }
+
+    //ends the stage and records it
+    void stop();
+
+private:
+    std::string name;
+    ResourceUsage start;
+    u_int64_t peakRss; //the highest mark read since the start
+    std::vector< std::pair<std::string, u_int64_t> > counts;
+    bool stopped;
+};
+
+class RunStats {
+public:
+    struct Stage {
+        std::string name;
+        ResourceUsage start, end;
+        u_int64_t peakRss; //the peak of the stage itself
+        std::vector< std::pair<std::string, u_int64_t> > counts;
+    };
+
+    //the stages recorded so far, in the order they ended
+    static std::vector<Stage>& getStages();
+
+    //writes the stages recorded so far, and the totals of the process
+    static void save(const std::string &filename);
+};
+
+#endif //_RUNSTATS_H
@@ -0,0 +1,222 @@
+/*
+ * SequenceCache.cpp
+ * Building and loading of the 2-bit sequence cache of the strains
+ *
+ */
+
+#include "SequenceCache.h"
+#include "KmerStreamer.h"
+#include <cstring>
+#include <mutex>
+#include <algorithm>
+
+using namespace std;
+
+//file layout: header, then a record per cached strain (in any order), then the table of the record offsets
+//(0 for a strain that is not cached) and the paths of the strains
+//a record is its header, the end of each sequence, the lowercase runs, the mask runs and the packed bases
+static const char SEQUENCE_CACHE_MAGIC[8] = {'U','C','S','E','Q','C','0','1'};
+struct SequenceCacheHeader {
+    char magic[8];
+    u_int64_t nbStrains;
+    u_int64_t tableOffset;
+};
+struct SequenceCacheRecordHeader {
+    u_int64_t nbSequences;
+    u_int64_t nbBases;
+    u_int64_t nbLowercaseRuns;
+    u_int64_t nbMaskRuns;
+};
+
+//extends the last run if it ends at pos with the same character, or starts a new one
+static inline void addToRuns(vector<SequenceRun> &runs, u_int64_t pos, u_int32_t character) {
+    if (!runs.empty() && runs.back().begin + runs.back().length == pos && runs.back().character == character &&
+        runs.back().length < (u_int32_t)-1) {
+        runs.back().length++;
+        return;
+    }
+    SequenceRun run;
+    run.begin = pos;
+    run.length = 1;
+    run.character = character;
+    runs.push_back(run);
+}
+
+static void writeOrDie(FILE *file, const void *data, size_t size, const string &filename) {
+    if (size > 0 && fwrite(data, 1, size, file) != size)
+        fatalError("Error writing the sequence cache " + filename);
+}
+
+void SequenceCache::build(const string &filename, const vector<Strain> &strains, const vector<int> &strainIndices, int nbCores) {
+    string tmpFilename = filename + ".part";
+    FILE *file = fopen(tmpFilename.c_str(), "wb");
+    if (file == NULL)
+        fatalError("Could not open file " + tmpFilename + " for writing");
+
+    SequenceCacheHeader header;
+    memcpy(header.magic, SEQUENCE_CACHE_MAGIC, sizeof(SEQUENCE_CACHE_MAGIC));
+    header.nbStrains = strains.size();
+    header.tableOffset = 0;
+    writeOrDie(file, &header, sizeof(header), tmpFilename);
+    u_int64_t fileOffset = sizeof(header);
+    vector<u_int64_t> recordOffsets(strains.size(), 0);
+
+    //each thread parses a strain and encodes it, then the records are appended to the file as they are done
+    mutex fileMutex;
+    u_int64_t nbStrainsDone = 0;
+    Dispatcher dispatcher(nbCores);
+    if (!strainIndices.empty()) {
+        Range<size_t>::Iterator strainsIt(0, strainIndices.size() - 1);
+        dispatcher.iterate(strainsIt, [&](size_t i) {
+            int strainIndex = strainIndices[i];
+            SequenceCacheRecordHeader recordHeader;
+            vector<u_int64_t> sequenceEnds, words;
+            vector<SequenceRun> lowercaseRuns, maskRuns;
+            u_int64_t pos = 0;
+
+            IBank *inputBank = Bank::open(strains[strainIndex].path);
+            LOCAL(inputBank);
+            Iterator<Sequence> *it = inputBank->iterator();
+            LOCAL(it);
+            for (it->first(); !it->isDone(); it->next()) {
+                const char *data = it->item().getDataBuffer();
+                size_t size = it->item().getDataSize();
+                words.resize((pos + size + 31) / 32, 0);
+                for (size_t j = 0; j < size; j++, pos++) {
+                    signed char code = KMER_STREAMER_NT_CODE[(unsigned char)data[j]];
+                    if (code < 0) {
+                        addToRuns(maskRuns, pos, (unsigned char)data[j]);
+                        continue;
+                    }
+                    if (data[j] >= 'a')
+                        addToRuns(lowercaseRuns, pos, 0);
+                    words[pos >> 5] |= (u_int64_t)code << (2 * (pos & 31));
+                }
+                sequenceEnds.push_back(pos);
+            }
+            recordHeader.nbSequences = sequenceEnds.size();
+            recordHeader.nbBases = pos;
+            recordHeader.nbLowercaseRuns = lowercaseRuns.size();
+            recordHeader.nbMaskRuns = maskRuns.size();
+
+            lock_guard<mutex> lock(fileMutex);
+            recordOffsets[strainIndex] = fileOffset;
+            writeOrDie(file, &recordHeader, sizeof(recordHeader), tmpFilename);
+            writeOrDie(file, sequenceEnds.data(), sequenceEnds.size() * sizeof(u_int64_t), tmpFilename);
+            writeOrDie(file, lowercaseRuns.data(), lowercaseRuns.size() * sizeof(SequenceRun), tmpFilename);
+            writeOrDie(file, maskRuns.data(), maskRuns.size() * sizeof(SequenceRun), tmpFilename);
+            writeOrDie(file, words.data(), words.size() * sizeof(u_int64_t), tmpFilename);
+            fileOffset += sizeof(recordHeader) + (sequenceEnds.size() + words.size()) * sizeof(u_int64_t) +
+                          (lowercaseRuns.size() + maskRuns.size()) * sizeof(SequenceRun);
+            cout << '\r' << ++nbStrainsDone << "/" << strainIndices.size() << " strains parsed.";
+            cout.flush();
+        }, 1);
+        cout << endl;
+    }
+
+    //the table, with the paths of the cached strains
+    header.tableOffset = fileOffset;
+    writeOrDie(file, recordOffsets.data(), recordOffsets.size() * sizeof(u_int64_t), tmpFilename);
+    for (size_t i = 0; i < strains.size(); i++) {
+        const string &path = recordOffsets[i] != 0 ? strains[i].path : string();
+        u_int64_t length = path.size();
+        writeOrDie(file, &length, sizeof(length), tmpFilename);
+        writeOrDie(file, path.data(), path.size(), tmpFilename);
+    }
+    fseek(file, 0, SEEK_SET);
+    writeOrDie(file, &header, sizeof(header), tmpFilename);
+    if (fclose(file) != 0)
+        fatalError("Error writing the sequence cache " + tmpFilename);
+    boost::filesystem::rename(tmpFilename, filename);
+}
+
+SequenceCache::SequenceCache(const string &filename) {
+    try {
+        mappedFile.open(filename);
+    } catch (const exception &e) {
+        fatalError("Could not map the sequence cache " + filename + ": " + e.what());
+    }
+
+    SequenceCacheHeader header;
+    if (mappedFile.size() < sizeof(header))
+        fatalError("Sequence cache " + filename + " is truncated.");
+    memcpy(&header, mappedFile.data(), sizeof(header));
+    if (memcmp(header.magic, SEQUENCE_CACHE_MAGIC, sizeof(SEQUENCE_CACHE_MAGIC)) != 0)
+        fatalError(filename + " is not a sequence cache (or was written by an incompatible version).");
+    if (header.tableOffset + header.nbStrains * sizeof(u_int64_t) > mappedFile.size())
+        fatalError("Sequence cache " + filename + " is truncated.");
+
+    const char *data = mappedFile.data();
+    const u_int64_t *recordOffsets = reinterpret_cast<const u_int64_t*>(data + header.tableOffset);
+    records.resize(header.nbStrains);
+    for (size_t i = 0; i < header.nbStrains; i++) {
+        StrainRecord &record = records[i];
+        memset(&record, 0, sizeof(record));
+        if (recordOffsets[i] == 0)
+            continue;
+        SequenceCacheRecordHeader recordHeader;
+        memcpy(&recordHeader, data + recordOffsets[i], sizeof(recordHeader));
+        record.nbSequences = recordHeader.nbSequences;
+        record.nbBases = recordHeader.nbBases;
+        record.nbLowercaseRuns = recordHeader.nbLowercaseRuns;
+        record.nbMaskRuns = recordHeader.nbMaskRuns;
+        const char *recordData = data + recordOffsets[i] + sizeof(recordHeader);
+        record.sequenceEnds = reinterpret_cast<const u_int64_t*>(recordData);
+        record.lowercaseRuns = reinterpret_cast<const SequenceRun*>(record.sequenceEnds + record.nbSequences);
+        record.maskRuns = record.lowercaseRuns + record.nbLowercaseRuns;
+        record.words = reinterpret_cast<const u_int64_t*>(record.maskRuns + record.nbMaskRuns);
+        if ((const char*)(record.words + (record.nbBases + 31) / 32) > data + header.tableOffset)
+            fatalError("Sequence cache " + filename + " is truncated.");
+    }
+
+    const char *pathsData = data + header.tableOffset + header.nbStrains * sizeof(u_int64_t);
+    for (size_t i = 0; i < header.nbStrains; i++) {
+        u_int64_t length;
+        if (pathsData + sizeof(length) > data + mappedFile.size())
+            fatalError("Sequence cache " + filename + " is truncated.");
+        memcpy(&length, pathsData, sizeof(length));
+        pathsData += sizeof(length);
+        if (pathsData + length > data + mappedFile.size())
+            fatalError("Sequence cache " + filename + " is truncated.");
+        paths.push_back(string(pathsData, length));
+        pathsData += length;
+    }
+}
+
+bool SequenceCache::exists(const string &filename) {
+    ifstream file(filename, ios::binary);
+    char magic[sizeof(SEQUENCE_CACHE_MAGIC)];
+    return file.read(magic, sizeof(magic)) && memcmp(magic, SEQUENCE_CACHE_MAGIC, sizeof(magic)) == 0;
+}
+
+//sets the characters of the runs overlapping [begin, end) of a strain in buffer, which holds the bases from begin
+static void applyRuns(const SequenceRun *runs, u_int64_t nbRuns, u_int64_t begin, u_int64_t end, char *buffer) {
+    //the runs are sorted and do not overlap: the first one ending after begin is found by binary search
+    const SequenceRun *run = partition_point(runs, runs + nbRuns,
+                                             [&](const SequenceRun &r) { return r.begin + r.length <= begin; });
+    for (; run != runs + nbRuns && run->begin < end; ++run) {
+        u_int64_t runEnd = min(run->begin + run->length, end);
+        for (u_int64_t pos = max(run->begin, begin); pos < runEnd; pos++)
+            buffer[pos - begin] = run->character == 0 ? buffer[pos - begin] + ('a' - 'A') : (char)run->character;
+    }
+}
+
+void SequenceCache::getSequence(size_t strainIndex, u_int64_t sequence, char *buffer) const {
+    static const char bases[4] = {'A', 'C', 'T', 'G'};
+    const StrainRecord &record = records[strainIndex];
+    u_int64_t begin = sequence == 0 ? 0 : record.sequenceEnds[sequence-1];
+    u_int64_t end = record.sequenceEnds[sequence];
+    for (u_int64_t pos = begin; pos < end; pos++)
+        buffer[pos - begin] = bases[(record.words[pos >> 5] >> (2 * (pos & 31))) & 3];
+    applyRuns(record.lowercaseRuns, record.nbLowercaseRuns, begin, end, buffer);
+    applyRuns(record.maskRuns, record.nbMaskRuns, begin, end, buffer);
+}
+
+void SequenceCache::getSequences(size_t strainIndex, vector<string> &sequences) const {
+    sequences.resize(getNbSequences(strainIndex));
+    for (u_int64_t sequence = 0; sequence < sequences.size(); sequence++) {
+        sequences[sequence].resize(getSequenceLength(strainIndex, sequence));
+        if (!sequences[sequence].empty())
+            getSequence(strainIndex, sequence, &sequences[sequence][0]);
+    }
+}
@@ -0,0 +1,170 @@
+/*
+ * SequenceCache.h
+ * The sequences of the strains, parsed once and stored 2-bit packed in a file mapped in memory
+ *
+ * Each strain file is parsed a single time (by GATB, so the supported formats are unchanged),
+ * and its sequences are stored concatenated, 2 bits per base (GATB code: A=0, C=1, T=2, G=3,
+ * 32 bases per 64-bit word, base i at bits 2*(i%32)). The characters that are not ACGT are
+ * kept exactly as runs of the same character (N and IUPAC codes), and so is the case
+ * (runs of lowercase acgt), so that the decoded sequences are the ones of the file.
+ *
+ * Both the graph construction (through SequenceCacheBank) and the mapping read the cache,
+ * which is written in a temporary file renamed once complete, so that an interrupted run
+ * never leaves a truncated cache behind.
+ *
+ */
+
+#ifndef _SEQUENCECACHE_H
+#define _SEQUENCECACHE_H
+
+#include <gatb/gatb_core.hpp>
+#include <vector>
+#include <string>
+#include <sys/types.h>
+#include <boost/iostreams/device/mapped_file.hpp>
+#include "Utils.h"
+
+//a run of length identical characters (or of lowercase bases) starting at base begin of a strain
+struct SequenceRun {
+    u_int64_t begin;
+    u_int32_t length;
+    u_int32_t character; //0 for a lowercase run
+};
+
+class SequenceCache {
+public:
+    //maps a cache written by build()
+    SequenceCache(const std::string &filename);
+
+    //parses the given strains with nbCores threads and writes their cache in filename
+    //(the other strains are not in the cache)
+    static void build(const std::string &filename, const std::vector<Strain> &strains, const std::vector<int> &strainIndices, int nbCores);
+
+    //true if the file is a cache written by build() (possibly of other strains)
+    static bool exists(const std::string &filename);
+
+    size_t getNbStrains() const { return records.size(); }
+    bool hasStrain(size_t strainIndex) const { return records[strainIndex].words != NULL; }
+    //true if the cache has the strain, and it was read from path
+    bool hasStrain(size_t strainIndex, const std::string &path) const {
+        return strainIndex < records.size() && hasStrain(strainIndex) && paths[strainIndex] == path;
+    }
+    const std::string& getPath(size_t strainIndex) const { return paths[strainIndex]; }
+    u_int64_t getNbSequences(size_t strainIndex) const { return records[strainIndex].nbSequences; }
+    u_int64_t getNbBases(size_t strainIndex) const { return records[strainIndex].nbBases; }
+    u_int64_t getSequenceLength(size_t strainIndex, u_int64_t sequence) const {
+        const StrainRecord &record = records[strainIndex];
+        return record.sequenceEnds[sequence] - (sequence == 0 ? 0 : record.sequenceEnds[sequence-1]);
+    }
+
+    //decodes a sequence of a strain in buffer, which must hold getSequenceLength() characters
+    void getSequence(size_t strainIndex, u_int64_t sequence, char *buffer) const;
+    //decodes all the sequences of a strain
+    void getSequences(size_t strainIndex, std::vector<std::string> &sequences) const;
+
+    //memory used by the cache, in bytes
+    u_int64_t getSize() const { return mappedFile.size(); }
+
+private:
+    struct StrainRecord {
+        u_int64_t nbSequences, nbBases, nbLowercaseRuns, nbMaskRuns;
+        const u_int64_t *sequenceEnds;
+        const SequenceRun *lowercaseRuns, *maskRuns;
+        const u_int64_t *words; //NULL if the strain is not in the cache
+    };
+
+    std::vector<StrainRecord> records;
+    std::vector<std::string> paths;
+    boost::iostreams::mapped_file_source mappedFile;
+};
+
+//GATB bank of all the sequences of a cache, strain after strain, so that the graph is built without parsing the files again
+class SequenceCacheBank : public AbstractBank {
+public:
+    SequenceCacheBank(const SequenceCache &cache, const std::string &id) : cache(cache), id(id) {}
+
+    std::string getId() { return id; }
+
+    Iterator<Sequence>* iterator() { return new SequenceIterator(cache); }
+
+    int64_t getNbItems() {
+        u_int64_t nbSequences = 0;
+        for (size_t i = 0; i < cache.getNbStrains(); i++)
+            if (cache.hasStrain(i))
+                nbSequences += cache.getNbSequences(i);
+        return nbSequences;
+    }
+
+    int64_t estimateNbItems() { return getNbItems(); }
+
+    u_int64_t getSize() {
+        u_int64_t nbBases = 0;
+        for (size_t i = 0; i < cache.getNbStrains(); i++)
+            if (cache.hasStrain(i))
+                nbBases += cache.getNbBases(i);
+        return nbBases;
+    }
+
+    void estimate(u_int64_t &number, u_int64_t &totalSize, u_int64_t &maxSize) {
+        number = getNbItems();
+        totalSize = getSize();
+        maxSize = 0;
+        for (size_t i = 0; i < cache.getNbStrains(); i++)
+            if (cache.hasStrain(i))
+                for (u_int64_t sequence = 0; sequence < cache.getNbSequences(i); sequence++)
+                    maxSize = std::max(maxSize, cache.getSequenceLength(i, sequence));
+    }
+
+private:
+    class SequenceIterator : public Iterator<Sequence> {
+    public:
+        SequenceIterator(const SequenceCache &cache) : cache(cache), strain(0), sequence(0), index(0) {}
+
+        void first() {
+            strain = 0;
+            sequence = 0;
+            index = 0;
+            skipDone();
+            load();
+        }
+
+        void next() {
+            sequence++;
+            index++;
+            skipDone();
+            load();
+        }
+
+        bool isDone() { return strain >= cache.getNbStrains(); }
+
+        Sequence& item() { return current; }
+
+    private:
+        const SequenceCache &cache;
+        size_t strain;
+        u_int64_t sequence, index;
+        Sequence current;
+
+        //goes to the next strain of the cache once all the sequences of this one are read
+        void skipDone() {
+            while (strain < cache.getNbStrains() && (!cache.hasStrain(strain) || sequence >= cache.getNbSequences(strain))) {
+                strain++;
+                sequence = 0;
+            }
+        }
+
+        void load() {
+            if (isDone())
+                return;
+            u_int64_t length = cache.getSequenceLength(strain, sequence);
+            current.getData().resize(length);
+            cache.getSequence(strain, sequence, current.getData().getBuffer());
+            current.setIndex(index);
+        }
+    };
+
+    const SequenceCache &cache;
+    std::string id;
+};
+
+#endif //_SEQUENCECACHE_H
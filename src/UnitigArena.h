@@ -0,0 +1,78 @@
+/*
+ * UnitigArena.h
+ * The sequences of all unitigs, 2-bit packed one after the other, with their offsets
+ *
+ * Unitigs are stored with GATB's encoding (A=0, C=1, T=2, G=3), 32 bases per
+ * 64-bit word, so that the kmers at their extremities can be read back directly
+ * as encoded kmers. This is how the unitigs are passed from their construction
+ * to the writing of the graph files, instead of a temporary FASTA file.
+ *
+ */
+
+#ifndef _UNITIGARENA_H
+#define _UNITIGARENA_H
+
+#include <vector>
+#include <string>
+#include <sys/types.h>
+#include "KmerStreamer.h"
+
+class UnitigArena {
+public:
+    UnitigArena() : nbBases(0) {
+        offsets.push_back(0);
+    }
+
+    //appends a unitig (made of ACGT only), which gets the next id
+    void add(const std::string &sequence) {
+        words.resize((nbBases + sequence.size() + 31) / 32, 0);
+        for (size_t i = 0; i < sequence.size(); i++, nbBases++)
+            words[nbBases >> 5] |= (u_int64_t)KMER_STREAMER_NT_CODE[(unsigned char)sequence[i]] << (2 * (nbBases & 31));
+        offsets.push_back(nbBases);
+    }
+
+    u_int64_t getNbUnitigs() const { return offsets.size() - 1; }
+    u_int64_t getLength(u_int64_t unitigId) const { return offsets[unitigId+1] - offsets[unitigId]; }
+
+    //2-bit code of the pos-th base of a unitig
+    int getCode(u_int64_t unitigId, u_int64_t pos) const {
+        u_int64_t base = offsets[unitigId] + pos;
+        return (words[base >> 5] >> (2 * (base & 31))) & 3;
+    }
+
+    //the bases [pos, pos+length) of a unitig, encoded as a kmer (the first base in the highest bits)
+    template<typename Type>
+    Type encode(u_int64_t unitigId, u_int64_t pos, size_t length) const {
+        Type value = Type(0);
+        for (size_t i = 0; i < length; i++)
+            value = (value << 2) | Type(getCode(unitigId, pos + i));
+        return value;
+    }
+
+    //decodes a unitig in sequence (which is reused, to avoid allocations)
+    void getSequence(u_int64_t unitigId, std::string &sequence) const {
+        static const char bases[4] = {'A', 'C', 'T', 'G'};
+        u_int64_t length = getLength(unitigId);
+        sequence.resize(length);
+        for (u_int64_t i = 0; i < length; i++)
+            sequence[i] = bases[getCode(unitigId, i)];
+    }
+
+    std::string getSequence(u_int64_t unitigId) const {
+        std::string sequence;
+        getSequence(unitigId, sequence);
+        return sequence;
+    }
+
+    //memory used, in bytes
+    u_int64_t getSize() const {
+        return words.size() * sizeof(u_int64_t) + offsets.size() * sizeof(u_int64_t);
+    }
+
+private:
+    u_int64_t nbBases;
+    std::vector<u_int64_t> words;
+    std::vector<u_int64_t> offsets;
+};
+
+#endif //_UNITIGARENA_H
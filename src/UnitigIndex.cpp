@@ -0,0 +1,71 @@
+/*
+ * UnitigIndex.cpp
+ * Saving and loading of the kmer to unitig index
+ *
+ */
+
+#include "UnitigIndex.h"
+#include <cstring>
+
+using namespace std;
+
+//file layout: header, then the packed entries (64-bit words), then the unitig lengths (32-bit)
+static const char UNITIG_INDEX_MAGIC[8] = {'U','C','U','I','D','X','0','1'};
+struct UnitigIndexHeader {
+    char magic[8];
+    u_int64_t nbKmers;
+    u_int64_t nbUnitigs;
+    int32_t kmerSize;
+    int32_t lean;
+    int32_t idBits;
+    int32_t posBits;
+};
+
+UnitigIndex::UnitigIndex(const string &filename) {
+    try {
+        mappedFile.open(filename);
+    } catch (const exception &e) {
+        fatalError("Could not map the unitig index " + filename + ": " + e.what());
+    }
+
+    UnitigIndexHeader header;
+    if (mappedFile.size() < sizeof(header))
+        fatalError("Unitig index " + filename + " is truncated.");
+    memcpy(&header, mappedFile.data(), sizeof(header));
+    if (memcmp(header.magic, UNITIG_INDEX_MAGIC, sizeof(UNITIG_INDEX_MAGIC)) != 0)
+        fatalError(filename + " is not a unitig index (or was written by an incompatible version).");
+
+    nbKmers = header.nbKmers;
+    nbUnitigs = header.nbUnitigs;
+    kmerSize = header.kmerSize;
+    lean = header.lean;
+    idBits = header.idBits;
+    posBits = header.posBits;
+    entryBits = idBits + (lean ? 0 : 1 + posBits);
+    entryMask = (entryBits == 64) ? ~(u_int64_t)0 : (((u_int64_t)1 << entryBits) - 1);
+
+    if (mappedFile.size() != sizeof(header) + getNbWords() * sizeof(u_int64_t) + nbUnitigs * sizeof(u_int32_t))
+        fatalError("Unitig index " + filename + " is truncated.");
+    entries = reinterpret_cast<const u_int64_t*>(mappedFile.data() + sizeof(header));
+    lengths = reinterpret_cast<const u_int32_t*>(mappedFile.data() + sizeof(header) + getNbWords() * sizeof(u_int64_t));
+}
+
+void UnitigIndex::save(const string &filename) const {
+    UnitigIndexHeader header;
+    memcpy(header.magic, UNITIG_INDEX_MAGIC, sizeof(UNITIG_INDEX_MAGIC));
+    header.nbKmers = nbKmers;
+    header.nbUnitigs = nbUnitigs;
+    header.kmerSize = kmerSize;
+    header.lean = lean;
+    header.idBits = idBits;
+    header.posBits = posBits;
+
+    ofstream indexFile;
+    openFileForWriting(filename, indexFile);
+    indexFile.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    indexFile.write(reinterpret_cast<const char*>(entries), getNbWords() * sizeof(u_int64_t));
+    indexFile.write(reinterpret_cast<const char*>(lengths), nbUnitigs * sizeof(u_int32_t));
+    indexFile.close();
+    if (!indexFile)
+        fatalError("Error writing the unitig index " + filename);
+}
@@ -0,0 +1,129 @@
+/*
+ * UnitigIndex.h
+ * Compact map from the MPHF index of each kmer to its unitig (id, strand and position)
+ *
+ * Each kmer takes idBits (+ 1 strand bit + posBits) bits, packed in 64-bit words,
+ * instead of a 20 bytes UnitigIdStrandPos. Per-unitig data (the unitig lengths) is
+ * stored once per unitig. A lean index stores only the unitig ids, which is all
+ * that plain mapping needs.
+ *
+ * The index can be saved next to the GATB graph and loaded back by mapping the
+ * file in memory, so that mapping can run as a separate stage.
+ *
+ */
+
+#ifndef _UNITIGINDEX_H
+#define _UNITIGINDEX_H
+
+#include <vector>
+#include <string>
+#include <stdexcept>
+#include <sys/types.h>
+#include <boost/iostreams/device/mapped_file.hpp>
+#include "Utils.h"
+
+class UnitigIndex {
+public:
+    //nbKmers: number of entries (solid kmers); maxUnitigId, maxPos: upper bounds of the values that will be stored
+    UnitigIndex(u_int64_t nbKmers, u_int64_t maxUnitigId, u_int64_t maxPos, int kmerSize, bool lean) :
+        nbKmers(nbKmers), kmerSize(kmerSize), lean(lean) {
+        idBits = getNbBits(maxUnitigId);
+        posBits = lean ? 0 : getNbBits(maxPos);
+        entryBits = idBits + (lean ? 0 : 1 + posBits);
+        entryMask = (entryBits == 64) ? ~(u_int64_t)0 : (((u_int64_t)1 << entryBits) - 1);
+        //one extra word, so that reading an entry never goes past the end
+        words.resize((nbKmers * entryBits + 63) / 64 + 1, 0);
+        entries = words.data();
+        lengths = NULL;
+        nbUnitigs = 0;
+    }
+
+    //loads an index written by save(), by mapping the file in memory
+    UnitigIndex(const std::string &filename);
+
+    //writes the index to a file
+    void save(const std::string &filename) const;
+
+    //stores the unitig of a kmer. Thread-safe as long as each kmer is set only once
+    void set(u_int64_t kmerIndex, u_int64_t unitigId, char strand, u_int64_t pos) {
+        u_int64_t value = unitigId;
+        if (!lean)
+            value |= ((u_int64_t)(strand == 'R') << idBits) | (pos << (idBits + 1));
+
+        u_int64_t bitPos = kmerIndex * entryBits;
+        size_t word = bitPos >> 6;
+        int offset = bitPos & 63;
+        __sync_fetch_and_or(&words[word], value << offset);
+        if (offset + entryBits > 64)
+            __sync_fetch_and_or(&words[word+1], value >> (64 - offset));
+    }
+
+    //stores the length of the next unitig
+    void addUnitig(u_int64_t length) {
+        unitigLengths.push_back(length);
+        lengths = unitigLengths.data();
+        nbUnitigs = unitigLengths.size();
+    }
+
+    int getUnitigId(u_int64_t kmerIndex) const {
+        return getEntry(kmerIndex) & (((u_int64_t)1 << idBits) - 1);
+    }
+
+    //decodes the whole entry of a kmer (not available in a lean index)
+    UnitigIdStrandPos get(u_int64_t kmerIndex) const {
+        if (lean)
+            throw std::runtime_error("Strands and positions of the kmers are not stored in a lean unitig index.");
+        u_int64_t entry = getEntry(kmerIndex);
+        int unitigId = entry & (((u_int64_t)1 << idBits) - 1);
+        char strand = ((entry >> idBits) & 1) ? 'R' : 'F';
+        int pos = entry >> (idBits + 1);
+        return UnitigIdStrandPos(unitigId, strand, pos, lengths[unitigId], kmerSize);
+    }
+
+    int getUnitigLength(int unitigId) const { return lengths[unitigId]; }
+    u_int64_t getNbKmers() const { return nbKmers; }
+    u_int64_t getNbUnitigs() const { return nbUnitigs; }
+    int getKmerSize() const { return kmerSize; }
+    bool isLean() const { return lean; }
+
+    //memory used, in bytes
+    u_int64_t getSize() const {
+        return getNbWords() * sizeof(u_int64_t) + nbUnitigs * sizeof(u_int32_t);
+    }
+
+private:
+    u_int64_t nbKmers;
+    int kmerSize;
+    bool lean;
+    int idBits, posBits, entryBits;
+    u_int64_t entryMask;
+    u_int64_t nbUnitigs;
+
+    //the data is either owned (when building the index) or in a mapped file (when loaded)
+    const u_int64_t *entries;
+    const u_int32_t *lengths;
+    std::vector<u_int64_t> words;
+    std::vector<u_int32_t> unitigLengths;
+    boost::iostreams::mapped_file_source mappedFile;
+
+    u_int64_t getNbWords() const { return (nbKmers * entryBits + 63) / 64 + 1; }
+
+    static int getNbBits(u_int64_t maxValue) {
+        int nbBits = 1;
+        while (nbBits < 64 && (maxValue >> nbBits) != 0)
+            nbBits++;
+        return nbBits;
+    }
+
+    u_int64_t getEntry(u_int64_t kmerIndex) const {
+        u_int64_t bitPos = kmerIndex * entryBits;
+        size_t word = bitPos >> 6;
+        int offset = bitPos & 63;
+        u_int64_t value = entries[word] >> offset;
+        if (offset + entryBits > 64)
+            value |= entries[word+1] << (64 - offset);
+        return value & entryMask;
+    }
+};
+
+#endif //_UNITIGINDEX_H
@@ -116,15 +116,12 @@ void checkStrainsFile(const string &strainsFile) {
     }
     allIds.insert(id);
 
-    //check if the path is ok
-    ifstream file;
-    openFileForReading(path, file);
-    if (!file.is_open()) {
+    //check if the path is ok (the file is only opened once, when its sequences are cached)
+    if (!boost::filesystem::is_regular_file(path)) {
       stringstream ss;
       ss << "Error opening file " << path << " in " << strainsFile << endl;
       fatalError(ss.str());
     }
-    file.close();
 
     //add the strain
     Strain strain(id, path);
@@ -193,6 +190,22 @@ int getNbLinesInFile(const string &filename) {
 }
 
 
+//Read the sequences of all unitigs of a .nodes file, indexed by unitig id
+vector<string> getUnitigSequencesFromNodesFile(const string &nodesFile) {
+  vector<string> unitigSequences(getNbLinesInFile(nodesFile));
+
+  ifstream nodesFileReader;
+  openFileForReading(nodesFile, nodesFileReader);
+  int id;
+  string seq;
+  while (nodesFileReader >> id >> seq)
+    unitigSequences[id] = seq;
+  nodesFileReader.close();
+
+  return unitigSequences;
+}
+
+
 void checkParametersBuildDBG(Tool *tool) {
 
   //check the strains file
@@ -211,6 +224,35 @@ void checkParametersBuildDBG(Tool *tool) {
 }
 
 
+//the map subcommand needs the output folder of a previous run, with its graph
+//the query subcommand also needs the outputs of that run, to which the new strains are added
+void checkParametersMapReads(Tool *tool, bool query) {
+
+  //check the strains file
+  string strainsFile = tool->getInput()->getStr(STR_STRAINS_FILE);
+  checkStrainsFile(strainsFile);
+
+  //check output
+  string outputFolderPath = stripLastSlashIfExists(tool->getInput()->getStr(STR_OUTPUT));
+  for (const string &file : {string("/graph.h5"), string("/graph.nodes"), string("/graph.unitig_index")}) {
+    if (!boost::filesystem::exists(outputFolderPath + file)) {
+      stringstream ss;
+      ss << "Could not find " << outputFolderPath << file << " - the graph must have been built by a previous run with the same output folder.";
+      fatalError(ss.str());
+    }
+  }
+
+  if (query) {
+    for (const string &file : {string("/unitigs.txt"), string("/unitigs.unique_rows.Rtab")}) {
+      if (!boost::filesystem::exists(outputFolderPath + file) && !boost::filesystem::exists(outputFolderPath + file + ".gz")) {
+        stringstream ss;
+        ss << "Could not find " << outputFolderPath << file << " - the strains must have been mapped by a previous run with the same output folder.";
+        fatalError(ss.str());
+      }
+    }
+  }
+}
+
 
 void fatalError (const string &message) {
   cerr << endl << endl << "[FATAL ERROR] " << message << endl << endl;
@@ -288,7 +330,8 @@ void createFolder(const string &path) {
   if (boost::filesystem::exists(folder))
     return;
 
-  if (!boost::filesystem::create_directories(folder)) {
+  //another process (e.g. a mapping shard) may create it at the same time
+  if (!boost::filesystem::create_directories(folder) && !boost::filesystem::is_directory(folder)) {
     stringstream ss;
     ss << "Could not create dir " << path << " - unknown reasons...";
     fatalError(ss.str());
@@ -70,7 +70,11 @@ void copyDirectoryRecursively(const fs::path& sourceDir, const fs::path& destina
 
 int getNbLinesInFile(const string &filename);
 
+//Read the sequences of all unitigs of a .nodes file, indexed by unitig id
+vector<string> getUnitigSequencesFromNodesFile(const string &nodesFile);
+
 void checkParametersBuildDBG(Tool *tool);
+void checkParametersMapReads(Tool *tool, bool query=false);
 void fatalError (const string &message);
 void executeCommand(const string &command, bool verbose=true, const string &messageIfItFails="");
 void openFileForReading(const string &filePath, ifstream &stream);
@@ -116,22 +120,14 @@ public:
 
 struct Strain {
     string id, path;
+    //path is empty for the strains read back from the outputs of a previous run
     Strain(const string &id, const string &path) : id(id) {
       //transfor to canonical path
-      boost::filesystem::path boostPath(boost::filesystem::canonical(path));
-      this->path = boostPath.string();
-    }
-
-    static void createReadsFile(const string &readsFile, vector< Strain >* strains) {
-      ofstream fout;
-      openFileForWriting(readsFile, fout);
-
-      for (const auto &strain : (*strains))
-        fout << strain.path << endl;
-
-      fout.close();
+      if (!path.empty()) {
+        boost::filesystem::path boostPath(boost::filesystem::canonical(path));
+        this->path = boostPath.string();
+      }
     }
-
 };
 
 struct PatternFromStats {
@@ -30,7 +30,12 @@
 #include "build_dbg.hpp"
 #include "global.h"
 #include "GraphOutput.h"
+#include "KmerStreamer.h"
+#include "UnitigArena.h"
+#include "SequenceCache.h"
+#include "RunStats.h"
 #include "version.h"
+#include <mutex>
 
 using namespace std;
 
@@ -52,179 +57,197 @@ build_dbg::build_dbg ()  : Tool ("unitig-counter") //give a name to our tool
     populateParser(this);
 }
 
-void buildSequence (
-        const Graph& graph,
-        const Node& startingNode,
-        size_t length,
-        size_t nbContigs,
-        const string& consensusRight,
-        const string& consensusLeft,
-        Sequence& seq
-)
+//writes the unitigs in FASTA, as GATB's BankFasta did (the header is "<id>__len__<length> ")
+void writeUnitigsFasta (const UnitigArena& unitigs, const string& filename)
 {
-    /** Shortcuts. */
-    Data&  data     = seq.getData();
+    ofstream fastaFile;
+    openFileForWriting(filename, fastaFile);
+    string sequence;
+    for (u_int64_t id = 0; id < unitigs.getNbUnitigs(); id++) {
+        unitigs.getSequence(id, sequence);
+        fastaFile << ">" << id << "__len__" << sequence.size() << " \n" << sequence << "\n";
+    }
+    fastaFile.close();
+}
 
-    /** We set the sequence comment. */
-    stringstream ss1;
-    ss1 << nbContigs << "__len__" << length << " ";
-    seq._comment = ss1.str();
+//walks from node as long as the path is simple (a single successor, which has a single predecessor), appending the
+//last nucleotide of each node reached to extension. The walk also stops before reaching a node whose kmer is one of
+//the stop kmers; cycle is set if it is because it came back to start (same kmer and strand). Returns the last node reached
+Node extendUnitig(const Graph& graph, const Node& start, const Node::Value& stopKmer1, const Node::Value& stopKmer2,
+                  string& extension, bool& cycle)
+{
+    size_t kmerSize = graph.getKmerSize();
+    Node current = start;
+    cycle = false;
+    while (true) {
+        GraphVector<Node> successors = graph.successors(current);
+        if (successors.size() != 1)
+            break;
+        Node next = successors[0];
+        if (graph.predecessors(next).size() != 1)
+            break;
+        if (next.kmer == stopKmer1 || next.kmer == stopKmer2) {
+            cycle = (next == start);
+            break;
+        }
+        //the last nucleotide of next, read from its kmer (the last one of a forward kmer, in its low bits, or the
+        //complement of the first one of a reverse kmer) rather than from a string of the whole kmer
+        u_int8_t code = (next.strand == STRAND_FORWARD) ? next.kmer[0] : (next.kmer[kmerSize-1] ^ 2);
+        extension += "ACTG"[code];
+        current = next;
+    }
+    return current;
+}
 
-    /** We set the data length. */
-    seq.getData().resize (length);
+//a unitig found by a thread, with the key giving its final id
+struct UnitigSequence {
+    u_int64_t key;
+    string sequence;
+    UnitigSequence(u_int64_t key, const string& sequence) : key(key), sequence(sequence) {}
+    bool operator < (const UnitigSequence& other) const { return key < other.key; }
+};
+
+//builds the unitig going through startingNode. Its key is the smallest MPHF index of its two extremity kmers, and it is
+//oriented so that this extremity comes first (the smallest of the sequence and its reverse complement on ties), so that
+//the unitig is the same whatever the node it was built from
+UnitigSequence buildUnitig(const Graph& graph, const Node& startingNode)
+{
+    string right, left;
+    bool cycle;
+    Node rightEnd = extendUnitig(graph, startingNode, startingNode.kmer, startingNode.kmer, right, cycle);
+    if (cycle) {
+        //a circular unitig has no extremity: it is started from its kmer with the smallest MPHF index instead
+        Node minNode = startingNode, current = startingNode;
+        u_int64_t minIndex = graph.nodeMPHFIndex(startingNode);
+        for (size_t i = 0; i < right.size(); i++) {
+            current = graph.successors(current)[0];
+            u_int64_t index = graph.nodeMPHFIndex(current);
+            if (index < minIndex) {
+                minIndex = index;
+                minNode = current;
+            }
+        }
+        Node start(minNode.kmer, STRAND_FORWARD);
+        right.clear();
+        extendUnitig(graph, start, start.kmer, start.kmer, right, cycle);
+        return UnitigSequence(minIndex, graph.toString(start) + right);
+    }
+    Node leftEnd = graph.reverse(extendUnitig(graph, graph.reverse(startingNode), startingNode.kmer, rightEnd.kmer, left, cycle));
 
-    //We fill the data
-    string finalSequence = consensusLeft + graph.toString (startingNode) + consensusRight;
-    for (size_t i=0;i<finalSequence.size();i++)
-        data[i] = finalSequence[i];
+    string sequence = reverse_complement(left) + graph.toString(startingNode) + right;
+    u_int64_t leftIndex = graph.nodeMPHFIndex(leftEnd), rightIndex = graph.nodeMPHFIndex(rightEnd);
+    if (leftIndex > rightIndex || (leftIndex == rightIndex && reverse_complement(sequence) < sequence))
+        sequence = reverse_complement(sequence);
+    return UnitigSequence(min(leftIndex, rightIndex), sequence);
 }
 
-//Params:
-//graph: the GATB graph
-//node: a given node
-//unitigPart: the exact substring of the unitig that refer to this node
-//returns:
-//'F' if the FORWARD node represented by the input node appears in the FORWARD sequence of the unitig
-//'R' if the FORWARD node represented by the input node appears in the REVCOMPL sequence of the unitig
-char getUnitigStrandTheForwardNodeMapsTo(const gatb::core::debruijn::impl::Graph& graph, const Node &node, const string &unitigPart) {
-    //get the forward node of the node given as parameter
-    Node forwardNode = node;
-    if (node.strand == gatb::core::kmer::STRAND_REVCOMP) //if the node given is not the forward node
-        forwardNode = graph.reverse(forwardNode); //reverse it
-    if (unitigPart == graph.toString(forwardNode))
-        return 'F';
-    else if (reverse_complement(unitigPart) == graph.toString(forwardNode))
-        return 'R';
-    else
-        throw new runtime_error("Fatal bug on build_dbg.cpp::getUnitigStrandTheForwardNodeMapsTo()");
+//associates each kmer of the unitigs to its unitig id, and to its strand and position if the index is not lean
+//the kmers are re-encoded from the unitig sequences, so that each unitig is handled independently by any thread
+template<size_t span>
+void fillUnitigIndex(const Graph& graph, const UnitigArena& unitigs, UnitigIndex& nodeIdToUnitigId, Dispatcher& dispatcher)
+{
+    if (unitigs.getNbUnitigs() == 0)
+        return;
+    size_t kmerSize = graph.getKmerSize();
+    Range<u_int64_t>::Iterator unitigsIt(0, unitigs.getNbUnitigs() - 1);
+    dispatcher.iterate(unitigsIt, [&](u_int64_t unitigId) {
+        string unitig = unitigs.getSequence(unitigId);
+        KmerStreamer<span> kmerStreamer(kmerSize);
+        kmerStreamer.reset(unitig.c_str(), unitig.size());
+        while (kmerStreamer.next()) {
+            //the streamer gives the canonical (forward) node: its strand tells if it appears in the forward or
+            //reverse complement sequence of the unitig
+            Node node = kmerStreamer.node();
+            size_t pos = kmerStreamer.position();
+            char strand = (node.strand == STRAND_FORWARD) ? 'F' : 'R';
+            nodeIdToUnitigId.set(graph.nodeMPHFIndex(node), unitigId, strand, (strand=='F' ? pos : unitig.size()-pos-kmerSize));
+        }
+    });
 }
 
-void construct_linear_seqs (const gatb::core::debruijn::impl::Graph& graph, const string& linear_seqs_name,
-                            vector< UnitigIdStrandPos >& nodeIdToUnitigId)
+//builds the unitigs of the graph with nbCores threads, stores them in unitigs and returns the kmer to unitig index
+//Threads claim the unitigs with atomic marks on the MPHF indexes of their kmers. The unitig ids are then given by sorting
+//the unitigs on their key, which does not depend on the threads
+template<size_t span>
+UnitigIndex* construct_linear_seqs (const gatb::core::debruijn::impl::Graph& graph, UnitigArena& unitigArena,
+                                    u_int64_t nbKmers, bool lean, int nbCores)
 {
     using namespace gatb::core::debruijn::impl;
     using namespace gatb::core::tools::misc::impl;
 
-    IBank* outputBank = new BankFasta (linear_seqs_name.c_str());
-    LOCAL (outputBank);
-
-    // We create a Terminator object - this will mark the nodes that are already built
-    MPHFTerminator terminator (graph);
-
-    // We create a BranchingTerminator object - this will mark the nodes where to stop the traversal
-    BranchingTerminator branchingTerminator(graph);
-
-    // We create a Traversal instance to traverse unitigs
-    Traversal* traversal = Traversal::create (TRAVERSAL_UNITIG, graph, branchingTerminator);
-    LOCAL (traversal);
+    size_t kmerSize = graph.getKmerSize();
 
-    Path consensusRight;
-    Path consensusLeft;
-    Sequence seq (Data::ASCII);
-    u_int64_t nbContigs=0;
-    BankFasta::setDataLineSize(0);
+    //one bit per kmer, set once its unitig is claimed by a thread
+    vector<u_int64_t> marks((nbKmers + 63) / 64 + 1, 0);
+    auto isMarked = [&](u_int64_t index) -> bool {
+        return (__atomic_load_n(&marks[index >> 6], __ATOMIC_RELAXED) >> (index & 63)) & 1;
+    };
+    //returns true if the bit was already set
+    auto mark = [&](u_int64_t index) -> bool {
+        return (__sync_fetch_and_or(&marks[index >> 6], (u_int64_t)1 << (index & 63)) >> (index & 63)) & 1;
+    };
 
-    //We loop through the nodes and build the unitigs
-    ProgressGraphIterator<Node, ProgressTimerAndSystem> it (graph.iterator(), "Graph: building unitigs");
-    for (it.first(); !it.isDone(); it.next()) {
-        auto &startingNode = it.item();
-
-        if (terminator.is_marked(startingNode))
-            continue;
-
-        auto reversedNode = graph.reverse(startingNode);
-        int lenRight = traversal->traverse (startingNode, DIR_OUTCOMING, consensusRight);
-        int lenLeft = traversal->traverse (reversedNode, DIR_OUTCOMING, consensusLeft);
-        int lenTotal = graph.getKmerSize() + lenRight + lenLeft;
-
-        //mark the traversed nodes
-        terminator.mark(startingNode);
-        auto currentNode = startingNode;
-        for_each(consensusRight.path.begin(), consensusRight.path.end(), [&](const Nucleotide &nucleotide) {
-            currentNode = graph.successor(currentNode, nucleotide);
-            terminator.mark(currentNode);
-        });
-        currentNode = reversedNode;
-        for_each(consensusLeft.path.begin(), consensusLeft.path.end(), [&](const Nucleotide &nucleotide) {
-            currentNode = graph.successor(currentNode, nucleotide);
-            terminator.mark(currentNode);
-        });
+    vector<UnitigSequence> unitigs;
+    std::mutex unitigsMutex;
 
-        // We get the unitig strings
-        string consensusLeftStr;
-        {
-            stringstream ss;
-            ss << consensusLeft;
-            consensusLeftStr=reverse_complement(ss.str());
-        }
-
-        string consensusRightStr;
-        {
-            stringstream ss;
-            ss << consensusRight;
-            consensusRightStr=ss.str();
-        }
-
-
-        /** We create the contig sequence. */
-        buildSequence(graph, startingNode, lenTotal, nbContigs, consensusRightStr, consensusLeftStr, seq);
-
-        //associate the node id to its unitig id
-        //Note: GATB kmer is any kmer... It is not the canonical one (i.e. smaller one). Maybe is the one that was added...
-        //Anyway, for a given kmer, we have it as forward node and reverse node. The forward node is what it counts (and it is not necessarily the canonical kmer)
-        char strand = getUnitigStrandTheForwardNodeMapsTo(graph, startingNode, seq.toString().substr(lenLeft, graph.getKmerSize()));
-        nodeIdToUnitigId[graph.nodeMPHFIndex(startingNode)] = UnitigIdStrandPos(nbContigs,
-                                                                                strand,
-                                                                                (strand=='F' ? lenLeft : lenRight),
-                                                                                lenTotal, graph.getKmerSize());
-        currentNode = startingNode;
-        int i=1;
-        for_each(consensusRight.path.begin(), consensusRight.path.end(), [&](const Nucleotide &nucleotide) {
-            currentNode = graph.successor(currentNode, nucleotide);
-            strand = getUnitigStrandTheForwardNodeMapsTo(graph, currentNode, seq.toString().substr(lenLeft+i, graph.getKmerSize()));
-            nodeIdToUnitigId[graph.nodeMPHFIndex(currentNode)] = UnitigIdStrandPos(nbContigs,
-                                                                                   strand,
-                                                                                   (strand=='F' ? lenLeft+i : lenRight-i),
-                                                                                   lenTotal, graph.getKmerSize());
-            i++;
-        });
-
-        currentNode = graph.reverse(startingNode);
-        i=-1;
-        for_each(consensusLeft.path.begin(), consensusLeft.path.end(), [&](const Nucleotide &nucleotide) {
-            currentNode = graph.successor(currentNode, nucleotide);
-            strand = getUnitigStrandTheForwardNodeMapsTo(graph, currentNode, seq.toString().substr(lenLeft+i, graph.getKmerSize()));
-            nodeIdToUnitigId[graph.nodeMPHFIndex(currentNode)] = UnitigIdStrandPos(nbContigs,
-                                                                                   strand,
-                                                                                   (strand=='F' ? lenLeft+i : lenRight-i),
-                                                                                   lenTotal, graph.getKmerSize());
-            i--;
+    Dispatcher dispatcher(nbCores);
+    {
+        ProgressGraphIterator<Node, ProgressTimerAndSystem> it (graph.iterator(), "Graph: building unitigs");
+        dispatcher.iterate(it, [&](const Node& startingNode) {
+            if (isMarked(graph.nodeMPHFIndex(startingNode)))
+                return;
+
+            //the unitig is traversed without holding anything: the thread that first marks its key owns it,
+            //and the others (which were traversing it at the same time) drop their copy
+            UnitigSequence unitig = buildUnitig(graph, startingNode);
+            if (mark(unitig.key))
+                return;
+
+            //mark all its kmers, so that no thread starts a traversal from them anymore
+            KmerStreamer<span> kmerStreamer(kmerSize);
+            kmerStreamer.reset(unitig.sequence.c_str(), unitig.sequence.size());
+            while (kmerStreamer.next())
+                mark(graph.nodeMPHFIndex(kmerStreamer.node()));
+
+            std::lock_guard<std::mutex> lock(unitigsMutex);
+            unitigs.push_back(std::move(unitig));
         });
-
-
-        /** We add the sequence into the output bank. */
-        outputBank->insert (seq);
-
-        //increase the number of contigs
-        nbContigs += 1;
     }
+    marks.clear(); marks.shrink_to_fit(); // release memory
+
+    //the unitig ids follow the keys
+    sort(unitigs.begin(), unitigs.end());
+    u_int64_t maxLength = kmerSize;
+    for (auto &unitig : unitigs) {
+        maxLength = max<u_int64_t>(maxLength, unitig.sequence.size());
+        unitigArena.add(unitig.sequence);
+        string().swap(unitig.sequence); // release memory
+    }
+    unitigs.clear(); unitigs.shrink_to_fit(); // release memory
+
+    //now that the number of unitigs and their lengths are known, the index entries take as few bits as possible
+    UnitigIndex* nodeIdToUnitigId = new UnitigIndex(nbKmers, max<u_int64_t>(unitigArena.getNbUnitigs(), 1) - 1,
+                                                    maxLength - kmerSize, kmerSize, lean);
+    for (u_int64_t id = 0; id < unitigArena.getNbUnitigs(); id++)
+        nodeIdToUnitigId->addUnitig(unitigArena.getLength(id));
+    fillUnitigIndex<span>(graph, unitigArena, *nodeIdToUnitigId, dispatcher);
 
-    outputBank->flush ();
+    return nodeIdToUnitigId;
 }
 
 
 class EdgeConstructionVisitor : public boost::static_visitor<>    {
 private:
-    const string& linear_seqs_name;
+    const UnitigArena& unitigs;
 
 public:
-    EdgeConstructionVisitor (const string &linear_seqs_name) : linear_seqs_name(linear_seqs_name) {}
+    EdgeConstructionVisitor (const UnitigArena &unitigs) : unitigs(unitigs) {}
     template<size_t span>
     void operator() (GraphOutput<span>& graphOutput) const
     {
         graphOutput.open();
-        graphOutput.load_nodes_extremities(linear_seqs_name);
-        graphOutput.construct_graph(linear_seqs_name);
+        graphOutput.load_nodes_extremities(unitigs);
+        graphOutput.construct_graph(unitigs);
         graphOutput.close();
     }
 };
@@ -256,20 +279,50 @@ void build_dbg::execute ()
 
     int nbCores = getInput()->getInt(STR_NBCORES);
 
-    //create the reads file
-    string readsFile(tmpFolder+string("/readsFile"));
-    Strain::createReadsFile(readsFile, strains);
-
-    //Builds the DBG using GATB
+    //parse the strains once, into the sequence cache that the mapping reads too
+    string sequenceCacheFilename(tmpFolder+string("/sequences.cache"));
+    vector<int> allStrains;
+    for (size_t i = 0; i < strains->size(); i++)
+        allStrains.push_back(i);
+    cout << "[Parsing the strains...]" << endl;
+    RunStage parseStage("parse_strains");
+    SequenceCache::build(sequenceCacheFilename, *strains, allStrains, nbCores);
+    parseStage.setCount("strains", allStrains.size());
+    parseStage.stop();
+
+    //Builds the DBG using GATB, from the sequences of the cache
     //TODO: by using create() and assigning to a Graph object, the copy constructor does a shallow or deep copy??
-    graph = new Graph(gatb::core::debruijn::impl::Graph::create("-in %s -kmer-size %d -abundance-min 0 -out %s/graph -nb-cores %d",
-                                                          readsFile.c_str(), kmerSize, outputFolder.c_str(), nbCores));
+    {
+        RunStage graphStage("graph_build");
+        SequenceCache sequenceCache(sequenceCacheFilename);
+        IBank *sequenceBank = new SequenceCacheBank(sequenceCache, sequenceCacheFilename);
+        LOCAL(sequenceBank);
+        graphStage.setCount("sequences", sequenceBank->getNbItems());
+        graphStage.setCount("bases", sequenceBank->getSize());
+        graph = new Graph(gatb::core::debruijn::impl::Graph::create(sequenceBank, "-kmer-size %d -abundance-min 0 -out %s/graph -nb-cores %d",
+                                                              kmerSize, outputFolder.c_str(), nbCores));
+        graphStage.setCount("kmers", graph->getInfo()["kmers_nb_solid"]->getInt());
+    }
 
     // Finding the unitigs
     //nodeIdToUnitigId translates the nodes that are stored in the GATB graph to the id of the unitigs together with the unitig strand
-    nodeIdToUnitigId = new vector< UnitigIdStrandPos >((size_t)graph->getInfo()["kmers_nb_solid"]->getInt()); //map nodeMPFHIndex() to unitigIds and strand
-    string linear_seqs_name = outputFolder+"/graph.unitigs";
-    construct_linear_seqs (*graph, linear_seqs_name, *nodeIdToUnitigId);
+    //Only the unitig-jump mapping needs the strands and positions of the kmers: the index is lean otherwise
+    //The unitigs are built by nbCores threads, and kept in memory
+    u_int64_t nbKmers = graph->getInfo()["kmers_nb_solid"]->getInt();
+    bool lean = !getInput()->get(STR_UNITIG_JUMP);
+    UnitigArena unitigArena;
+    RunStage unitigsStage("unitig_construction");
+    if (kmerSize < KMER_SPAN(0))  {  nodeIdToUnitigId = construct_linear_seqs<KMER_SPAN(0)>(*graph, unitigArena, nbKmers, lean, nbCores); }
+    else if (kmerSize < KMER_SPAN(1))  {  nodeIdToUnitigId = construct_linear_seqs<KMER_SPAN(1)>(*graph, unitigArena, nbKmers, lean, nbCores); }
+    else if (kmerSize < KMER_SPAN(2))  {  nodeIdToUnitigId = construct_linear_seqs<KMER_SPAN(2)>(*graph, unitigArena, nbKmers, lean, nbCores); }
+    else if (kmerSize < KMER_SPAN(3))  {  nodeIdToUnitigId = construct_linear_seqs<KMER_SPAN(3)>(*graph, unitigArena, nbKmers, lean, nbCores); }
+    else { throw gatb::core::system::Exception ("Graph failure because of unhandled kmer size %d", kmerSize); }
+
+    //save the index next to the graph, so that the mapping can be (re-)run on its own
+    nodeIdToUnitigId->save(outputFolder+string("/graph.unitig_index"));
+    unitigsStage.setCount("kmers", nbKmers);
+    unitigsStage.setCount("unitigs", unitigArena.getNbUnitigs());
+    unitigsStage.stop();
 
     //builds and outputs .nodes and .edges.dbg files
     typedef boost::variant <
@@ -279,21 +332,32 @@ void build_dbg::execute ()
         GraphOutput<KMER_SPAN(3)>
     >  GraphOutputVariant;
 
+    RunStage edgesStage("edge_construction");
     GraphOutputVariant graphOutput;
-    if (kmerSize < KMER_SPAN(0))  {  graphOutput = GraphOutput<KMER_SPAN(0)>(graph, outputFolder+string("/graph")); }
-    else if (kmerSize < KMER_SPAN(1))  {  graphOutput = GraphOutput<KMER_SPAN(1)>(graph, outputFolder+string("/graph")); }
-    else if (kmerSize < KMER_SPAN(2))  {  graphOutput = GraphOutput<KMER_SPAN(2)>(graph, outputFolder+string("/graph")); }
-    else if (kmerSize < KMER_SPAN(3))  {  graphOutput = GraphOutput<KMER_SPAN(3)>(graph, outputFolder+string("/graph")); }
+    if (kmerSize < KMER_SPAN(0))  {  graphOutput = GraphOutput<KMER_SPAN(0)>(graph, outputFolder+string("/graph"), nbCores); }
+    else if (kmerSize < KMER_SPAN(1))  {  graphOutput = GraphOutput<KMER_SPAN(1)>(graph, outputFolder+string("/graph"), nbCores); }
+    else if (kmerSize < KMER_SPAN(2))  {  graphOutput = GraphOutput<KMER_SPAN(2)>(graph, outputFolder+string("/graph"), nbCores); }
+    else if (kmerSize < KMER_SPAN(3))  {  graphOutput = GraphOutput<KMER_SPAN(3)>(graph, outputFolder+string("/graph"), nbCores); }
     else { throw gatb::core::system::Exception ("Graph failure because of unhandled kmer size %d", kmerSize); }
-    boost::apply_visitor (EdgeConstructionVisitor(linear_seqs_name),  graphOutput);
-
-    //save disk space
-    remove(linear_seqs_name.c_str());
+    boost::apply_visitor (EdgeConstructionVisitor(unitigArena),  graphOutput);
+    edgesStage.setCount("unitigs", unitigArena.getNbUnitigs());
+    edgesStage.stop();
+
+    //the unitigs are only written in FASTA if asked
+    if (getInput()->get(STR_UNITIGS_FASTA)) {
+        RunStage fastaStage("write_unitigs_fasta");
+        writeUnitigsFasta(unitigArena, outputFolder+string("/graph.unitigs"));
+        fastaStage.setCount("unitigs", unitigArena.getNbUnitigs());
+    }
 
     //print some stats
     cout << "################################################################################" << endl;
     cout << "Stats: " << endl;
     cout << "Number of kmers: " << graph->getInfo()["kmers_nb_solid"]->getInt() << endl;
-    cout << "Number of unitigs: " << getNbLinesInFile(outputFolder+string("/graph.nodes")) << endl;
+    cout << "Number of unitigs: " << unitigArena.getNbUnitigs() << endl;
+    cout << "Size of the kmer to unitig index: " << nodeIdToUnitigId->getSize() / (1024*1024) << " MB" << (nodeIdToUnitigId->isLean() ? " (lean)" : "") << endl;
     cout << "################################################################################" << endl;
+
+    //the stats of the mapping are added once it is done
+    RunStats::save(outputFolder+string("/run_stats.json"));
 }
@@ -37,10 +37,20 @@ const char* STR_KSKMER_SIZE = "-k";
 const char* STR_OUTPUT = "-output";
 const char* STR_NBCORES = "-nb-cores";
 const char* STR_GZIP = "-gzip";
+const char* STR_GZIP_THREADS = "-gzip-threads";
+const char* STR_UNITIG_JUMP = "-unitig-jump";
+const char* STR_UNITIGS_FASTA = "-unitigs-fasta";
+const char* STR_UNITIG_MAJOR = "-unitig-major";
+const char* STR_NPY = "-npy";
+const char* STR_MATRIX_MAX_MEMORY = "-max-memory";
+const char* STR_SHARD = "-shard";
+const char* STR_READER_THREADS = "-reader-threads";
+const char* STR_READ_AHEAD = "-read-ahead";
+const char* STR_PROGRESS_INTERVAL = "-progress-interval";
 
 //global vars used by both programs
 Graph *graph;
-vector< UnitigIdStrandPos >* nodeIdToUnitigId;
+UnitigIndex* nodeIdToUnitigId;
 vector< Strain >* strains = NULL;
 
 void populateParser (Tool *tool) {
@@ -48,5 +58,15 @@ void populateParser (Tool *tool) {
   tool->getParser()->push_front (new OptionOneParam (STR_OUTPUT, "Path to the folder where the final and temporary files will be stored.",  false, "output"));
   tool->getParser()->push_front (new OptionOneParam (STR_KSKMER_SIZE, "K-mer size.",  false, "31"));
   tool->getParser()->push_front (new OptionOneParam (STR_STRAINS_FILE, "A text file describing the strains containing 2 columns: 1) ID of the strain; 2) Path to a multi-fasta file containing the sequences of the strain. This file needs a header.",  true));
-  tool->getParser()->push_front (new OptionNoParam (STR_GZIP, "Compress unitig output using gzip.", false));
+  tool->getParser()->push_front (new OptionNoParam (STR_GZIP, "Compress unitig output using gzip (BGZF blocks, with a .gzi index).", false));
+  tool->getParser()->push_front (new OptionOneParam (STR_GZIP_THREADS, "Number of threads compressing the outputs with -gzip (0 for all cores).",  false, "0"));
+  tool->getParser()->push_front (new OptionOneParam (STR_SHARD, "With the map subcommand, only map the i-th of N ranges of strains (i/N, from 0). The shards share the output folder, and their mappings are merged by the merge subcommand.",  false, ""));
+  tool->getParser()->push_front (new OptionOneParam (STR_PROGRESS_INTERVAL, "Seconds between the progress reports of the mapping, also written to progress.json in the output folder (0 for none).",  false, "10"));
+  tool->getParser()->push_front (new OptionOneParam (STR_READ_AHEAD, "Max number of strains loaded by the reader threads ahead of the mapping.",  false, "4"));
+  tool->getParser()->push_front (new OptionOneParam (STR_READER_THREADS, "Number of threads reading (and decompressing) the strain files ahead of the mapping threads, out of the cores (at most a quarter of them). 0 to load the files in the mapping threads.",  false, "2"));
+  tool->getParser()->push_front (new OptionOneParam (STR_MATRIX_MAX_MEMORY, "Memory budget of the presence pattern matrix, in MB (0 for no limit). A larger matrix is built out of core, a block of unitigs at a time, with the strain checkpoints and temporary files on disk.",  false, "0"));
+  tool->getParser()->push_front (new OptionNoParam (STR_NPY, "Also write the unique patterns, their unitigs and the unitig sequences as binary .npy files, which can be mapped in memory.", false));
+  tool->getParser()->push_front (new OptionNoParam (STR_UNITIG_MAJOR, "When mapping, set the presence of the unitigs directly in the unitigs x strains matrix. This avoids transposing it, which needs twice its memory.", false));
+  tool->getParser()->push_front (new OptionNoParam (STR_UNITIGS_FASTA, "Also write the unitigs to graph.unitigs in the output folder (FASTA).", false));
+  tool->getParser()->push_front (new OptionNoParam (STR_UNITIG_JUMP, "When mapping, follow the unitig sequences and only look up kmers at unitig boundaries and mismatches. Faster, but keeps all unitig sequences in memory.", false));
 }
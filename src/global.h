@@ -31,16 +31,27 @@
 #define KSGATB_GLOBAL_H
 #include <gatb/gatb_core.hpp>
 #include "Utils.h"
+#include "UnitigIndex.h"
 
 //global vars
 extern Graph *graph;
-extern vector< UnitigIdStrandPos >* nodeIdToUnitigId;
+extern UnitigIndex* nodeIdToUnitigId;
 extern vector< Strain >* strains;
 extern const char* STR_STRAINS_FILE;
 extern const char* STR_KSKMER_SIZE;
 extern const char* STR_OUTPUT;
 extern const char* STR_NBCORES;
 extern const char* STR_GZIP;
+extern const char* STR_GZIP_THREADS;
+extern const char* STR_UNITIG_JUMP;
+extern const char* STR_UNITIGS_FASTA;
+extern const char* STR_UNITIG_MAJOR;
+extern const char* STR_NPY;
+extern const char* STR_MATRIX_MAX_MEMORY;
+extern const char* STR_SHARD;
+extern const char* STR_READER_THREADS;
+extern const char* STR_READ_AHEAD;
+extern const char* STR_PROGRESS_INTERVAL;
 
 void populateParser (Tool *tool);
 
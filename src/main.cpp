@@ -49,9 +49,23 @@ int main (int argc, char* argv[])
 
     try
     {
-        //Build DBG
-        build_dbg().run(argc, argv);
-        map_reads().run(argc, argv);
+        if (argc > 1 && string(argv[1]) == "map") {
+            //Map the strains on the DBG built by a previous run, resuming from its checkpoints
+            map_reads().run(argc-1, argv+1);
+        }
+        else if (argc > 1 && string(argv[1]) == "merge") {
+            //Write the outputs from the strains mapped by the shards of a run (map -shard i/N)
+            map_reads(false, true).run(argc-1, argv+1);
+        }
+        else if (argc > 1 && string(argv[1]) == "query") {
+            //Add new strains to the outputs of a previous run, mapping them on its DBG without rebuilding it
+            map_reads(true).run(argc-1, argv+1);
+        }
+        else {
+            //Build DBG
+            build_dbg().run(argc, argv);
+            map_reads().run(argc, argv);
+        }
         cerr << "Done!" << endl;
     }
     catch (Exception& e)
@@ -30,177 +30,710 @@
 #include "global.h"
 #include "map_reads.hpp"
 #include "Utils.h"
-#include <boost/algorithm/string/predicate.hpp>
-#include <boost/dynamic_bitset.hpp>
+#include "KmerStreamer.h"
+#include "ChunkQueue.h"
+#include "BitMatrix.h"
+#include "BgzfSink.h"
+#include "NpyFile.h"
+#include "SequenceCache.h"
+#include "RunStats.h"
+#include "ProgressReporter.h"
 #include <boost/iostreams/filtering_stream.hpp>
 #include <boost/iostreams/filter/gzip.hpp>
 #include <boost/iostreams/device/file.hpp>
 #include <map>
-#define NB_OF_READS_NOTIFICATION_MAP_AND_PHASE 10 //Nb of reads that the map and phase must process for notification
+#include <unordered_map>
+#include <queue>
+#include <functional>
+#include <cstring>
+#define MAP_CHUNK_SIZE 1000000 //Nb of bases of the chunks in which the strains are split to be mapped by different threads
+#define PYSEER_OUTPUT_BLOCK_SIZE 10000 //Nb of lines of the blocks of the pyseer outputs formatted by different threads
+#define PATTERN_RUNS_MAX_FAN_IN 64 //Max nb of runs of patterns merged at once (each has its file open)
 using namespace std;
 
 namespace io = boost::iostreams;
 
-void mapReadToTheGraphCore(const string &read, const Graph &graph, const vector< UnitigIdStrandPos > &nodeIdToUnitigId,
-                           boost::dynamic_bitset<>& unitigPattern ) {
+//returns how many bases of read[from..) follow the unitig in the given orientation, starting at unitig position unitigPos
+//(e.g. how many of the next kmers of the read are known to be in this unitig)
+size_t getNbBasesFollowingUnitig(const char *read, size_t readLength, size_t from,
+                                 const string &unitig, bool forwardUnitig, size_t unitigPos) {
+    size_t nbBases = 0;
+    if (forwardUnitig) {
+        while (from+nbBases < readLength && unitigPos+nbBases < unitig.size() &&
+               KMER_STREAMER_NT_CODE[(unsigned char)read[from+nbBases]] == KMER_STREAMER_NT_CODE[(unsigned char)unitig[unitigPos+nbBases]])
+            nbBases++;
+    }
+    else {
+        //the read follows the reverse complement of the unitig (complement is code^2 in GATB's encoding)
+        while (from+nbBases < readLength && unitigPos+nbBases < unitig.size() &&
+               KMER_STREAMER_NT_CODE[(unsigned char)read[from+nbBases]] == (KMER_STREAMER_NT_CODE[(unsigned char)unitig[unitig.size()-1-unitigPos-nbBases]] ^ 2))
+            nbBases++;
+    }
+    return nbBases;
+}
+
+//maps the read[0..readLength) to the graph, adding the ids of the unitigs it goes through to unitigIds
+//returns the number of kmers of the read that were mapped (or found to be novel)
+//if unitigSequences is given and jump is set, once a kmer is found in a unitig, the read is compared to the unitig sequence and all
+//kmers that follow it are skipped: the graph is then only queried at unitig boundaries and mismatches
+//if novelSegments is given (this needs unitigSequences and a full index), each kmer is checked to really be in the graph, as the MPHF
+//gives an arbitrary index for kmers that are not in it (e.g. kmers of new strains). The [begin, end) segments of the read covered by
+//novel kmers are added to it
+//The read is compared to the unitig of a kmer once: the following kmers inside the stretch of the read that matched it are known
+//to be in that unitig, and are neither looked up nor compared again
+template<size_t span>
+size_t mapReadToTheGraphCore(const char *read, size_t readLength, const Graph &graph, KmerStreamer<span> &kmerStreamer,
+                             const UnitigIndex &nodeIdToUnitigId, const vector<string> *unitigSequences, bool jump,
+                             vector<int> &unitigIds, vector< pair<size_t, size_t> > *novelSegments = NULL ) {
     int lastUnitig=-1;
+    size_t kmerSize = graph.getKmerSize();
+    size_t nbKmers = 0;
+    //read[..matchEnd) follows the unitig matchUnitig, from the last kmer compared to it
+    size_t matchEnd = 0;
+    int matchUnitig = -1;
+
+    //goes through all nodes/kmers of the read that are composed only by ACGT
+    kmerStreamer.reset(read, readLength);
+    while (kmerStreamer.next()) {
+        nbKmers++;
+
+        //a kmer inside the matched stretch is in its unitig
+        if (kmerStreamer.position() + kmerSize <= matchEnd) {
+            if (lastUnitig != matchUnitig) {
+                unitigIds.push_back(matchUnitig);
+                lastUnitig = matchUnitig;
+            }
+            continue;
+        }
 
-    //goes through all nodes/kmers of the read
-    if (read.size() >= graph.getKmerSize()) {
-        for (std::size_t i = 0; i < read.size() - graph.getKmerSize() + 1; i++) {
-            string LRKmer = string(read.c_str() + i, graph.getKmerSize());
-
-            //TODO: From my tests, if you use buildNode with a Kmer containing an 'N', it will build a node with all Ns replaced by G
-            //TODO: However, Kmers containing Ns are NOT included in any unitig (i.e. the graph builder does not convert an N to a G, and build the graph. It simply disregards kmers containing Ns)
-            //TODO: this is a sanity check to also discard Kmers containing Ns
-            //TODO: check this with GATB team
-
-            //TODO: UPDATE
-            //TODO: Magali had a dataset where we had the base 'K' in the fasta file
-            //TODO: So I am just discarding all reads that are not composed by ACGT
-            if (!boost::all(LRKmer, [](char c) -> bool {
-                return c=='A' || c=='a' || c=='C' || c=='c' || c=='G' || c=='g' ||c=='T' || c=='t';
-            })) {
-                continue;
+        //get the unitig localization of this kmer
+        Node node = kmerStreamer.node();
+        u_int64_t index = graph.nodeMPHFIndex(node);
+        bool novel = novelSegments != NULL && index >= nodeIdToUnitigId.getNbKmers();
+        const auto unitigId = novel ? -1 : nodeIdToUnitigId.getUnitigId(index);
+
+        //number of bases of the read, from the kmer start, that follow the unitig (when known)
+        size_t nbBasesInUnitig = 0;
+        if (!novel && unitigSequences != NULL && !nodeIdToUnitigId.isLean()) {
+            //the stored strand and pos refer to the forward node, which is the read kmer if the node is forward
+            const auto unitigIdStrandPos = nodeIdToUnitigId.get(index);
+            bool forwardNode = (node.strand == STRAND_FORWARD);
+            bool forwardUnitig = (forwardNode == (unitigIdStrandPos.strand == 'F'));
+            size_t pos = forwardNode ? unitigIdStrandPos.pos : unitigIdStrandPos.unitigSize - unitigIdStrandPos.pos - kmerSize;
+            nbBasesInUnitig = getNbBasesFollowingUnitig(read, readLength, kmerStreamer.position(),
+                                                        (*unitigSequences)[unitigId], forwardUnitig, pos);
+            novel = novelSegments != NULL && nbBasesInUnitig < kmerSize;
+            if (nbBasesInUnitig >= kmerSize) {
+                matchEnd = kmerStreamer.position() + nbBasesInUnitig;
+                matchUnitig = unitigId;
             }
+        }
+
+        if (novel) {
+            size_t begin = kmerStreamer.position();
+            if (!novelSegments->empty() && novelSegments->back().second >= begin + kmerSize - 1)
+                novelSegments->back().second = begin + kmerSize;
+            else
+                novelSegments->push_back(make_pair(begin, begin + kmerSize));
+            lastUnitig = -1;
+            continue;
+        }
+
+        if( lastUnitig != unitigId ) {
+            unitigIds.push_back(unitigId);
+            lastUnitig = unitigId;
+        }
+
+        //all the following kmers that are still in the unitig are skipped
+        if (jump && nbBasesInUnitig > kmerSize) {
+            kmerStreamer.skip(nbBasesInUnitig - kmerSize);
+            nbKmers += nbBasesInUnitig - kmerSize;
+        }
+    }
+    return nbKmers;
+}
+
+//builds the index with the strands and positions of the kmers (which a lean index does not have) from the unitig sequences
+template<size_t span>
+UnitigIndex* buildFullUnitigIndex(const Graph &graph, const UnitigIndex &leanIndex, const vector<string> &unitigSequences,
+                                  Dispatcher &dispatcher) {
+    size_t kmerSize = graph.getKmerSize();
+    u_int64_t maxLength = kmerSize;
+    for (const auto &unitig : unitigSequences)
+        maxLength = max<u_int64_t>(maxLength, unitig.size());
+    UnitigIndex *fullIndex = new UnitigIndex(leanIndex.getNbKmers(), max<u_int64_t>(unitigSequences.size(), 1) - 1,
+                                             maxLength - kmerSize, kmerSize, false);
+    for (const auto &unitig : unitigSequences)
+        fullIndex->addUnitig(unitig.size());
+    if (unitigSequences.empty())
+        return fullIndex;
+
+    Range<u_int64_t>::Iterator unitigsIt(0, unitigSequences.size() - 1);
+    dispatcher.iterate(unitigsIt, [&](u_int64_t unitigId) {
+        const string &unitig = unitigSequences[unitigId];
+        KmerStreamer<span> kmerStreamer(kmerSize);
+        kmerStreamer.reset(unitig.c_str(), unitig.size());
+        while (kmerStreamer.next()) {
+            Node node = kmerStreamer.node();
+            size_t pos = kmerStreamer.position();
+            char strand = (node.strand == STRAND_FORWARD) ? 'F' : 'R';
+            fullIndex->set(graph.nodeMPHFIndex(node), unitigId, strand, (strand=='F' ? pos : unitig.size()-pos-kmerSize));
+        }
+    });
+    return fullIndex;
+}
+
+//The presence pattern of each strain is saved as soon as the strain is mapped, so that an interrupted mapping can be resumed
+//Checkpoint file: magic, number of unitigs, strain path, number of unitigs present, then their ids as varint-encoded deltas
+static const char CHECKPOINT_MAGIC[8] = {'U','C','C','K','P','T','0','1'};
+
+string getCheckpointFilename(const string &checkpointFolder, int strainIndex) {
+    stringstream ss;
+    ss << checkpointFolder << "/" << strainIndex << ".ckpt";
+    return ss.str();
+}
 
-            //build the node
-            Node node = graph.buildNode(LRKmer.c_str());
+//unitigIds: the unitigs present in the strain, sorted
+void saveCheckpoint(const string &filename, const string &strainPath, const vector<u_int64_t> &unitigIds, int nbContigs) {
+    string buffer(CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC));
+    auto appendVarint = [&](u_int64_t value) {
+        while (value >= 0x80) {
+            buffer.push_back((char)(value | 0x80));
+            value >>= 7;
+        }
+        buffer.push_back((char)value);
+    };
+    appendVarint(nbContigs);
+    appendVarint(strainPath.size());
+    buffer += strainPath;
+    appendVarint(unitigIds.size());
+    u_int64_t last = 0;
+    for (u_int64_t pos : unitigIds) {
+        appendVarint(pos - last);
+        last = pos;
+    }
 
-            //get the unitig localization of this kmer
-            u_int64_t index = graph.nodeMPHFIndex(node);
-            const auto unitigId = nodeIdToUnitigId[index].unitigId;
+    //written aside and renamed, so that a checkpoint is either complete or absent
+    string tmpFilename = filename + ".tmp";
+    ofstream checkpointFile;
+    openFileForWriting(tmpFilename, checkpointFile);
+    checkpointFile.write(buffer.data(), buffer.size());
+    checkpointFile.close();
+    if (!checkpointFile)
+        fatalError("Error writing checkpoint " + tmpFilename);
+    boost::filesystem::rename(tmpFilename, filename);
+}
 
-            if( lastUnitig != unitigId ) {
-            	unitigPattern.set(unitigId);
-                lastUnitig = unitigId;
+//returns false if there is no valid checkpoint for this strain and number of unitigs
+//otherwise, unitigIds gets the (sorted) unitigs present in the strain
+bool loadCheckpoint(const string &filename, const string &strainPath, int nbContigs, vector<u_int64_t> &unitigIds) {
+    if (!boost::filesystem::exists(filename))
+        return false;
+    string buffer = readFileAsString(filename.c_str());
+    size_t offset = sizeof(CHECKPOINT_MAGIC);
+    bool valid = buffer.size() >= offset && buffer.compare(0, offset, CHECKPOINT_MAGIC, offset) == 0;
+    auto readVarint = [&]() -> u_int64_t {
+        u_int64_t value = 0;
+        for (int shift = 0; valid; shift += 7) {
+            if (offset >= buffer.size() || shift > 63) {
+                valid = false;
+                break;
             }
+            unsigned char byte = buffer[offset++];
+            value |= (u_int64_t)(byte & 0x7f) << shift;
+            if (!(byte & 0x80))
+                break;
         }
+        return value;
+    };
+
+    valid = valid && readVarint() == (u_int64_t)nbContigs;
+    u_int64_t pathLength = readVarint();
+    valid = valid && offset + pathLength <= buffer.size() && buffer.compare(offset, pathLength, strainPath) == 0 && pathLength == strainPath.size();
+    offset += pathLength;
+    u_int64_t nbPresent = readVarint();
+    u_int64_t pos = 0;
+    unitigIds.clear();
+    for (u_int64_t i = 0; valid && i < nbPresent; i++) {
+        pos += readVarint();
+        if (pos >= (u_int64_t)nbContigs)
+            valid = false;
+        else
+            unitigIds.push_back(pos);
     }
+    if (!valid)
+        unitigIds.clear();
+    return valid;
 }
 
+//buffered reader of the varints of a checkpoint, from a given offset
+struct CheckpointReader {
+    ifstream file;
+    string filename;
+    char buffer[1 << 14];
+    size_t pos, size;
+    u_int64_t offset;
+
+    CheckpointReader(const string &filename, u_int64_t offset) : filename(filename), pos(0), size(0), offset(offset) {
+        openFileForReading(filename, file);
+        file.seekg(offset);
+    }
+
+    unsigned char readByte() {
+        if (pos == size) {
+            file.read(buffer, sizeof(buffer));
+            size = file.gcount();
+            pos = 0;
+            if (size == 0)
+                fatalError("Unexpected end of checkpoint " + filename);
+        }
+        offset++;
+        return buffer[pos++];
+    }
+
+    u_int64_t readVarint() {
+        u_int64_t value = 0;
+        for (int shift = 0; ; shift += 7) {
+            unsigned char byte = readByte();
+            value |= (u_int64_t)(byte & 0x7f) << shift;
+            if (!(byte & 0x80))
+                return value;
+        }
+    }
+};
+
+//the unitigs of a (valid) checkpoint, read in increasing order a block of unitigs at a time
+//the file is reopened for each block, as there may be too many strains to keep their files open
+struct CheckpointCursor {
+    string filename;
+    u_int64_t offset, nbLeft, lastId;
+
+    CheckpointCursor(const string &filename) : filename(filename), lastId(0) {
+        CheckpointReader reader(filename, sizeof(CHECKPOINT_MAGIC));
+        reader.readVarint(); //number of unitigs
+        u_int64_t pathLength = reader.readVarint();
+        for (u_int64_t i = 0; i < pathLength; i++)
+            reader.readByte();
+        nbLeft = reader.readVarint();
+        offset = reader.offset;
+    }
+
+    //calls f(unitigId) for the next unitigs of the checkpoint that are below end
+    template<typename Function>
+    void readUntil(u_int64_t end, Function f) {
+        if (nbLeft == 0)
+            return;
+        CheckpointReader reader(filename, offset);
+        for (; nbLeft > 0; nbLeft--) {
+            u_int64_t unitigOffset = reader.offset;
+            u_int64_t unitigId = lastId + reader.readVarint();
+            if (unitigId >= end) {
+                offset = unitigOffset; //read again with the next block
+                return;
+            }
+            f(unitigId);
+            lastId = unitigId;
+        }
+        offset = reader.offset;
+    }
+};
+
+//what the query mode reports about the kmers of the new strains that are not in the graph
+struct NovelKmersReport {
+    //a run of novel kmers: bases of the sequence-th sequence of a strain, starting at begin
+    struct NovelSequence {
+        size_t sequence, begin;
+        string bases;
+        NovelSequence(size_t sequence, size_t begin, const string &bases) : sequence(sequence), begin(begin), bases(bases) {}
+        bool operator < (const NovelSequence &other) const {
+            return sequence < other.sequence || (sequence == other.sequence && begin < other.begin);
+        }
+    };
+
+    vector<u_int64_t> nbKmers, nbNovelKmers;
+    vector< vector<NovelSequence> > novelSequences;
+    vector<bool> mapped;
+    NovelKmersReport(size_t nbStrains) : nbKmers(nbStrains, 0), nbNovelKmers(nbStrains, 0),
+                                         novelSequences(nbStrains), mapped(nbStrains, false) {}
+
+    //writes <outputFolder>/novel_kmers.txt and <outputFolder>/novel_sequences.fasta for the strains mapped in this run
+    //the chunks of a strain are mapped in any order, and a run of novel kmers may be cut where a sequence was split in pieces:
+    //the runs are sorted and merged back before being written
+    void save(const string &outputFolder, int kmerSize) {
+        ofstream countsFile, sequencesFile;
+        openFileForWriting(outputFolder+string("/novel_kmers.txt"), countsFile);
+        openFileForWriting(outputFolder+string("/novel_sequences.fasta"), sequencesFile);
+        countsFile << "strain_id\tnb_kmers\tnb_novel_kmers\n";
+        for (size_t i = 0; i < mapped.size(); i++) {
+            if (!mapped[i])
+                continue;
+            const string &id = (*strains)[i].id;
+            countsFile << id << "\t" << nbKmers[i] << "\t" << nbNovelKmers[i] << "\n";
+            auto &runs = novelSequences[i];
+            sort(runs.begin(), runs.end());
+            size_t nbMerged = 0;
+            for (size_t j = 0; j < runs.size(); j++) {
+                if (nbMerged > 0 && runs[nbMerged-1].sequence == runs[j].sequence &&
+                    runs[nbMerged-1].begin + runs[nbMerged-1].bases.size() >= runs[j].begin + kmerSize - 1) {
+                    auto &last = runs[nbMerged-1];
+                    size_t end = runs[j].begin + runs[j].bases.size();
+                    if (end > last.begin + last.bases.size())
+                        last.bases += runs[j].bases.substr(last.begin + last.bases.size() - runs[j].begin);
+                }
+                else
+                    runs[nbMerged++] = runs[j];
+            }
+            runs.resize(nbMerged, NovelSequence(0, 0, ""));
+            for (size_t j = 0; j < runs.size(); j++)
+                sequencesFile << ">" << id << "_" << j << " nb_kmers=" << runs[j].bases.size() - kmerSize + 1 << "\n"
+                              << runs[j].bases << "\n";
+        }
+        countsFile.close();
+        sequencesFile.close();
+    }
+};
+
+//where the presence patterns are kept while mapping
+enum PatternStorage {
+    STRAIN_MAJOR, //in the strains x unitigs matrix
+    UNITIG_MAJOR, //in the unitigs x strains matrix
+    ON_DISK       //only in the checkpoints of the strains, when the matrix does not fit in the memory budget
+};
+
 // We define a functor that will be cloned by the dispatcher
+// Each clone is a mapping thread, loading strain files and mapping chunks of them as given by the chunk queue,
+// or, with read-ahead, a reader thread only loading the strain files for the mapping threads
 struct MapAndPhase
 {
-	using bitmap_t = boost::dynamic_bitset<>;
-	using bitmap_container_t = vector< bitmap_t >;
-
 	const vector<string> &allReadFilesNames;
+    const SequenceCache *sequenceCache;
+    int nbMappingThreads;
     const Graph& graph;
     //const string &outputFolder;
     //const string &tmpFolder;
-    uint64_t &nbOfReadsProcessed;
+    ProgressReporter &progress;
     ISynchronizer* synchro;
-	vector<bitmap_t>& allUnitigPatterns;
-    vector< UnitigIdStrandPos > &nodeIdToUnitigId;
+	//strains x unitigs, or unitigs x strains (empty if the patterns are on disk)
+	BitMatrix& allUnitigPatterns;
+	PatternStorage patternStorage;
+	//unless strain-major, the unitigs found so far in the strains being mapped, for their checkpoints
+	vector< vector<u_int64_t> > &strainUnitigIds;
+    UnitigIndex &nodeIdToUnitigId;
+    const vector<string> *unitigSequences;
+    bool unitigJump;
     int nbContigs;
+    ChunkQueue &chunkQueue;
+    vector<size_t> &nbChunksLeft;
+    const string &checkpointFolder;
+    NovelKmersReport *novelKmersReport;
+
+    MapAndPhase (const vector<string> &allReadFilesNames, const SequenceCache *sequenceCache, int nbMappingThreads, const Graph& graph,
+                 ProgressReporter &progress, ISynchronizer* synchro,
+				 BitMatrix &allUnitigPatterns, PatternStorage patternStorage, vector< vector<u_int64_t> > &strainUnitigIds,
+				 UnitigIndex &nodeIdToUnitigId, const vector<string> *unitigSequences, bool unitigJump, int nbContigs,
+				 ChunkQueue &chunkQueue, vector<size_t> &nbChunksLeft, const string &checkpointFolder,
+				 NovelKmersReport *novelKmersReport) :
+        allReadFilesNames(allReadFilesNames), sequenceCache(sequenceCache), nbMappingThreads(nbMappingThreads), graph(graph),
+        progress(progress), synchro(synchro),
+        allUnitigPatterns(allUnitigPatterns), patternStorage(patternStorage), strainUnitigIds(strainUnitigIds),
+        nodeIdToUnitigId(nodeIdToUnitigId),
+        unitigSequences(unitigSequences), unitigJump(unitigJump), nbContigs(nbContigs), chunkQueue(chunkQueue),
+        nbChunksLeft(nbChunksLeft), checkpointFolder(checkpointFolder), novelKmersReport(novelKmersReport){}
+
+    void operator()(int threadId) {
+        ProgressCounters &counters = progress.getCounters(threadId);
+        //a thread that fails (e.g. on an unreadable file) stops the queue, so that the others do not wait for its chunks
+        try {
+            if (threadId >= nbMappingThreads) {
+                for (int fileToLoad; (fileToLoad = chunkQueue.nextFileToRead()) >= 0; )
+                    loadFile(fileToLoad, counters);
+                return;
+            }
 
-    struct MapAndPhaseIteratorListener : public IteratorListener {
-        uint64_t &nbOfReadsProcessed;
-        ISynchronizer* synchro;
-        MapAndPhaseIteratorListener(uint64_t &nbOfReadsProcessed, ISynchronizer* synchro) :
-            nbOfReadsProcessed(nbOfReadsProcessed), synchro(synchro){}
-
-        virtual void inc (u_int64_t ntasks_done) {
-            // We lock the synchronizer
-            synchro->lock ();
-
-            nbOfReadsProcessed+=NB_OF_READS_NOTIFICATION_MAP_AND_PHASE;
-            cout << '\r' << nbOfReadsProcessed << " reads processed.";
-            cout.flush();
+            int kmerSize = graph.getKmerSize();
+            if (kmerSize < KMER_SPAN(0))  {  run<KMER_SPAN(0)>(counters); }
+            else if (kmerSize < KMER_SPAN(1))  {  run<KMER_SPAN(1)>(counters); }
+            else if (kmerSize < KMER_SPAN(2))  {  run<KMER_SPAN(2)>(counters); }
+            else if (kmerSize < KMER_SPAN(3))  {  run<KMER_SPAN(3)>(counters); }
+            else { throw gatb::core::system::Exception ("Mapping failure because of unhandled kmer size %d", kmerSize); }
+        }
+        catch (...) {
+            chunkQueue.stop();
+            throw;
+        }
+    }
 
-            // We unlock the synchronizer
-            synchro->unlock ();
+    //loads the sequences of the i-th strain, from the sequence cache if it has them, and gives them to the chunk queue
+    void loadFile(int i, ProgressCounters &counters) {
+        // (lower case bases are handled when mapping)
+        shared_ptr<StrainSequences> strain = make_shared<StrainSequences>(i);
+        if (sequenceCache != NULL && sequenceCache->hasStrain(i, allReadFilesNames[i])) {
+            sequenceCache->getSequences(i, strain->sequences);
+        }
+        else {
+            IBank *inputBank = Bank::open(allReadFilesNames[i]);
+            LOCAL(inputBank);
+            Iterator<Sequence> *it = inputBank->iterator();
+            LOCAL(it);
+            for (it->first(); !it->isDone(); it->next())
+                strain->sequences.push_back(string(it->item().getDataBuffer(), it->item().getDataSize()));
         }
-    };
 
-    MapAndPhase (const vector<string> &allReadFilesNames, const Graph& graph,
-                 uint64_t &nbOfReadsProcessed, ISynchronizer* synchro,
-				 bitmap_container_t &allUnitigPatterns,
-				 vector< UnitigIdStrandPos > &nodeIdToUnitigId, int nbContigs) :
-        allReadFilesNames(allReadFilesNames), graph(graph),
-        nbOfReadsProcessed(nbOfReadsProcessed), synchro(synchro),
-        allUnitigPatterns(allUnitigPatterns), nodeIdToUnitigId(nodeIdToUnitigId), nbContigs(nbContigs){}
+        vector<SequenceChunk> chunks = SequenceChunk::split(strain, MAP_CHUNK_SIZE, graph.getKmerSize());
+        counters.add(counters.reads, strain->sequences.size());
+        synchro->lock ();
+        nbChunksLeft[i] = chunks.size();
+        if (novelKmersReport != NULL)
+            novelKmersReport->mapped[i] = true;
+        synchro->unlock ();
+        if (chunks.empty()) {
+            saveCheckpoint(getCheckpointFilename(checkpointFolder, i), allReadFilesNames[i], vector<u_int64_t>(), nbContigs);
+            counters.add(counters.strains, 1);
+        }
+        chunkQueue.push(chunks);
+    }
 
-    void operator()(int i) {
-        // We declare an input Bank and use it locally
-        IBank *inputBank = Bank::open(allReadFilesNames[i]);
-        LOCAL(inputBank);
+    //saves the checkpoint of a strain, once all its chunks are mapped (no other thread touches its pattern anymore)
+    void saveStrainCheckpoint(int strainIndex) {
+        vector<u_int64_t> unitigIds;
+        if (patternStorage != STRAIN_MAJOR) {
+            unitigIds.swap(strainUnitigIds[strainIndex]);
+            sort(unitigIds.begin(), unitigIds.end());
+            unitigIds.erase(unique(unitigIds.begin(), unitigIds.end()), unitigIds.end());
+        }
+        else {
+            BitMatrix::forEachSetBit(allUnitigPatterns.getRow(strainIndex), allUnitigPatterns.getNbWordsPerRow(),
+                                     [&](u_int64_t unitigId) { unitigIds.push_back(unitigId); });
+        }
+        saveCheckpoint(getCheckpointFilename(checkpointFolder, strainIndex), allReadFilesNames[strainIndex], unitigIds, nbContigs);
+    }
 
-        // Create and use a progress iterator
-        MapAndPhaseIteratorListener* mapAndPhaseIteratorListener = new MapAndPhaseIteratorListener(nbOfReadsProcessed, synchro);
-        SubjectIterator <Sequence> it(inputBank->iterator(), NB_OF_READS_NOTIFICATION_MAP_AND_PHASE, mapAndPhaseIteratorListener);
+    template<size_t span>
+    void run(ProgressCounters &counters) {
+        KmerStreamer<span> kmerStreamer(graph.getKmerSize());
+        vector<int> unitigIds;
+        vector< pair<size_t, size_t> > novelSegments;
+        vector<NovelKmersReport::NovelSequence> novelSequences;
+        SequenceChunk chunk;
+        int fileToLoad;
+        while (chunkQueue.next(chunk, fileToLoad)) {
+            if (fileToLoad >= 0) {
+                loadFile(fileToLoad, counters);
+                continue;
+            }
 
-        // We loop over sequences.
-        auto& unitigPattern = allUnitigPatterns[i];
-        unitigPattern.resize(nbContigs);
+            //map this chunk to the graph
+            unitigIds.clear();
+            novelSequences.clear();
+            u_int64_t nbKmers = 0, nbNovelKmers = 0;
+            for (const auto &piece : chunk.pieces) {
+                const string &sequence = chunk.strain->sequences[piece.sequence];
+                novelSegments.clear();
+                nbKmers += mapReadToTheGraphCore(sequence.c_str() + piece.begin, piece.end - piece.begin, graph, kmerStreamer,
+                                                 nodeIdToUnitigId, unitigSequences, unitigJump, unitigIds,
+                                                 novelKmersReport != NULL ? &novelSegments : NULL);
+                for (const auto &segment : novelSegments) {
+                    nbNovelKmers += segment.second - segment.first - graph.getKmerSize() + 1;
+                    novelSequences.push_back(NovelKmersReport::NovelSequence(piece.sequence, piece.begin + segment.first,
+                                             sequence.substr(piece.begin + segment.first, segment.second - segment.first)));
+                }
+            }
 
-        for (it.first(); !it.isDone(); it.next()) {
-            string read = (it.item()).toString();
-            //transform the read to upper case
-            for (std::size_t j=0;j<read.size();j++)
-                read[j]=toupper(read[j]);
+            //and OR the unitigs found into the strain presence pattern
+            //in unitig-major mode, the strain bit is set in each unitig row: other threads may be setting the bits
+            //of other strains in the same words, hence the atomic ORs
+            //on disk, the unitigs are only kept until the strain checkpoint is saved
+            int strainIndex = chunk.strain->strainIndex;
+            if (patternStorage == UNITIG_MAJOR) {
+                u_int64_t strainBit = (u_int64_t)1 << (strainIndex & 63);
+                for (int unitigId : unitigIds)
+                    __sync_fetch_and_or(&allUnitigPatterns.getRow(unitigId)[strainIndex >> 6], strainBit);
+            }
+            synchro->lock ();
+            if (patternStorage != STRAIN_MAJOR) {
+                auto &ids = strainUnitigIds[strainIndex];
+                ids.insert(ids.end(), unitigIds.begin(), unitigIds.end());
+            }
+            else {
+                u_int64_t *unitigPattern = allUnitigPatterns.getRow(strainIndex);
+                for (int unitigId : unitigIds)
+                    unitigPattern[unitigId >> 6] |= (u_int64_t)1 << (unitigId & 63);
+            }
+            if (novelKmersReport != NULL) {
+                novelKmersReport->nbKmers[strainIndex] += nbKmers;
+                novelKmersReport->nbNovelKmers[strainIndex] += nbNovelKmers;
+                auto &strainNovelSequences = novelKmersReport->novelSequences[strainIndex];
+                strainNovelSequences.insert(strainNovelSequences.end(), novelSequences.begin(), novelSequences.end());
+            }
+            bool strainDone = (--nbChunksLeft[strainIndex] == 0);
+            synchro->unlock ();
+            counters.add(counters.kmers, nbKmers);
 
-            //map this read to the graph
-            mapReadToTheGraphCore(read, graph, nodeIdToUnitigId, unitigPattern); // unitigIdToCount);
+            if (strainDone) {
+                saveStrainCheckpoint(strainIndex);
+                counters.add(counters.strains, 1);
+            }
         }
     }
 };
 
-map_reads::map_reads ()  : Tool ("map_reads") //give a name to our tool
+map_reads::map_reads (bool query, bool merge)  : Tool (query ? "query" : merge ? "merge" : "map_reads"), query(query), merge(merge) //give a name to our tool
 {
     populateParser(this);
 }
 
-std::vector< boost::dynamic_bitset<> >
-transposeXU( std::vector< boost::dynamic_bitset<> > &XUT )
+//transposes the strains x unitigs matrix XUT into the unitigs x strains matrix XU, with nbCores threads
+//The matrix is transposed by 64x64 tiles: each thread takes a block of 64 strains, transposes its tiles into
+//the 64 strain bits of each unitig row (a word no other thread writes), then releases the block
+BitMatrix transposeXU( BitMatrix &XUT, int nbCores )
 {
-	using bitmap_t = boost::dynamic_bitset<>;
-	using bitmap_container_t = std::vector< bitmap_t >;
+	const std::size_t nsamples( XUT.getNbRows() );
+	const std::size_t ncontigs = XUT.getNbCols();
+	BitMatrix XU(ncontigs, nsamples);
+	if (nsamples == 0 || ncontigs == 0)
+		return XU;
+
+	Dispatcher dispatcher(nbCores);
+	Range<size_t>::Iterator blocksIt(0, XUT.getNbBlocks() - 1);
+	dispatcher.iterate(blocksIt, [&](size_t block) {
+		u_int64_t tile[64];
+		size_t nbRowsInBlock = XUT.getNbRowsInBlock(block);
+		for (size_t word = 0; word < XUT.getNbWordsPerRow(); word++) {
+			for (size_t i = 0; i < 64; i++)
+				tile[i] = i < nbRowsInBlock ? XUT.getRow(block * 64 + i)[word] : 0;
+			BitMatrix::transposeTile(tile);
+			for (size_t i = 0; i < 64 && word * 64 + i < ncontigs; i++)
+				XU.getRow(word * 64 + i)[block] = tile[i];
+		}
+		// release memory
+		XUT.releaseBlock(block);
+	}, 1);
+	return XU;
+}
+
+//128-bit fingerprint of a pattern, made of two independently seeded 64-bit hashes of its words
+struct PatternFingerprint {
+    u_int64_t low, high;
+    bool operator==(const PatternFingerprint &other) const { return low == other.low && high == other.high; }
+};
 
-	const std::size_t nsamples( XUT.size() );
-	const std::size_t ncontigs = XUT[0].size();
-	bitmap_container_t XU; XU.resize(ncontigs);
-	for( auto& row: XU ) { row.resize(nsamples); }
+struct PatternFingerprintHash {
+    size_t operator()(const PatternFingerprint &fingerprint) const { return fingerprint.low; }
+};
 
-	// transpose the input matrix; this is a fairly expensive operation
-	// due to the horrible memory access patterns involved here
-	for( std::size_t i=0; i<XUT.size(); ++i )
-	{
-		auto& bitset = XUT[i];
-        auto pos = bitset.find_first();
-        while( pos != bitmap_t::npos )
-        {
-        	XU[pos].set(i);
-        	pos = bitset.find_next(pos);
-        }
-        // release memory
-        bitset.resize(0); bitmap_t(bitset).swap(bitset);
-	}
-	return XU;
+static inline u_int64_t mixPatternWord(u_int64_t x) {
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ULL;
+    x ^= x >> 33;
+    return x;
 }
 
-//pattern is the unitig line
-map< boost::dynamic_bitset<>, vector<int> > getUnitigsWithSamePattern (const vector< boost::dynamic_bitset<> > &XU) {
-	using bitmap_t = boost::dynamic_bitset<>;
-	using mapping_t = map< bitmap_t, vector<int> >;
+PatternFingerprint getPatternFingerprint(const u_int64_t *row, size_t nbWords) {
+    PatternFingerprint fingerprint = {0x9e3779b97f4a7c15ULL, 0x2545f4914f6cdd1dULL};
+    for (size_t word = 0; word < nbWords; word++) {
+        fingerprint.low = mixPatternWord(fingerprint.low ^ row[word]) + word;
+        fingerprint.high = mixPatternWord(fingerprint.high + row[word] * 0xbf58476d1ce4e5b9ULL) ^ word;
+    }
+    return fingerprint;
+}
 
-	// storage for unique patterns linked to all parent unitigs.
-	mapping_t pattern2Unitigs;
+//pattern is the unitig line
+//unitigs are hashed to a 128-bit fingerprint, then split by fingerprint in partitions deduplicated in parallel; equal fingerprints
+//are checked against the rows of XU, so that a collision cannot merge different patterns
+//the patterns are numbered in increasing order of their rows compared as numbers from their last word, as dynamic_bitset's operator< does
+UniquePatterns getUnitigsWithSamePattern (const BitMatrix &XU, int nbCores) {
+	const size_t nbUnitigs = XU.getNbRows();
+	const size_t nbWords = XU.getNbWordsPerRow();
+	UniquePatterns uniquePatterns;
+	uniquePatterns.offsets.push_back(0);
+	if (nbUnitigs == 0)
+		return uniquePatterns;
+
+	Dispatcher dispatcher(nbCores);
+	nbCores = dispatcher.getExecutionUnitsNumber();
+
+	//fingerprints of all unitigs, by blocks of 64 rows
+	vector<PatternFingerprint> fingerprints(nbUnitigs);
+	Range<size_t>::Iterator blocksIt(0, XU.getNbBlocks() - 1);
+	dispatcher.iterate(blocksIt, [&](size_t block) {
+		for (size_t i = block * 64; i < block * 64 + XU.getNbRowsInBlock(block); i++)
+			fingerprints[i] = getPatternFingerprint(XU.getRow(i), nbWords);
+	}, 16);
+
+	//counting sort of the unitigs by partition (they stay in increasing order in each partition)
+	const size_t nbPartitions = (size_t)nbCores * 16;
+	vector<u_int64_t> partitionOffsets(nbPartitions + 1, 0);
+	for (size_t i = 0; i < nbUnitigs; i++)
+		partitionOffsets[fingerprints[i].high % nbPartitions + 1]++;
+	for (size_t partition = 0; partition < nbPartitions; partition++)
+		partitionOffsets[partition + 1] += partitionOffsets[partition];
+	vector<u_int32_t> unitigsByPartition(nbUnitigs);
+	{
+		vector<u_int64_t> next(partitionOffsets.begin(), partitionOffsets.end() - 1);
+		for (size_t i = 0; i < nbUnitigs; i++)
+			unitigsByPartition[next[fingerprints[i].high % nbPartitions]++] = i;
+	}
 
-	for( std::size_t i=0; i<XU.size(); ++i ) //goes through all unitigs
+	//each unitig gets the first unitig having the same pattern as representative
+	vector<u_int32_t> representativeOf(nbUnitigs);
+	Range<size_t>::Iterator partitionsIt(0, nbPartitions - 1);
+	dispatcher.iterate(partitionsIt, [&](size_t partition) {
+		unordered_multimap<PatternFingerprint, u_int32_t, PatternFingerprintHash> representatives;
+		for (u_int64_t j = partitionOffsets[partition]; j < partitionOffsets[partition + 1]; j++) {
+			u_int32_t unitig = unitigsByPartition[j];
+			representativeOf[unitig] = unitig;
+			auto range = representatives.equal_range(fingerprints[unitig]);
+			for (auto it = range.first; it != range.second; ++it) {
+				if (memcmp(XU.getRow(it->second), XU.getRow(unitig), nbWords * sizeof(u_int64_t)) == 0) {
+					representativeOf[unitig] = it->second;
+					break;
+				}
+			}
+			if (representativeOf[unitig] == unitig)
+				representatives.insert(make_pair(fingerprints[unitig], unitig));
+		}
+	}, 1);
+	vector<PatternFingerprint>().swap(fingerprints);
+	vector<u_int32_t>().swap(unitigsByPartition);
+
+	//number the patterns
+	for (size_t i = 0; i < nbUnitigs; i++)
+		if (representativeOf[i] == i)
+			uniquePatterns.representatives.push_back(i);
+	sort(uniquePatterns.representatives.begin(), uniquePatterns.representatives.end(), [&](u_int32_t a, u_int32_t b) {
+		const u_int64_t *rowA = XU.getRow(a), *rowB = XU.getRow(b);
+		for (size_t word = nbWords; word > 0; word--)
+			if (rowA[word-1] != rowB[word-1])
+				return rowA[word-1] < rowB[word-1];
+		return false;
+	});
+
+	//the pattern id of each representative, then the CSR layout
+	vector<u_int32_t> patternOf(nbUnitigs);
+	for (size_t pattern = 0; pattern < uniquePatterns.size(); pattern++)
+		patternOf[uniquePatterns.representatives[pattern]] = pattern;
+	uniquePatterns.offsets.resize(uniquePatterns.size() + 1, 0);
+	for (size_t i = 0; i < nbUnitigs; i++)
+		uniquePatterns.offsets[patternOf[representativeOf[i]] + 1]++;
+	for (size_t pattern = 0; pattern < uniquePatterns.size(); pattern++)
+		uniquePatterns.offsets[pattern + 1] += uniquePatterns.offsets[pattern];
+	uniquePatterns.unitigs.resize(nbUnitigs);
 	{
-		pattern2Unitigs[XU[i]].push_back(i);
+		vector<u_int64_t> next(uniquePatterns.offsets.begin(), uniquePatterns.offsets.end() - 1);
+		for (size_t i = 0; i < nbUnitigs; i++)
+			uniquePatterns.unitigs[next[patternOf[representativeOf[i]]]++] = i;
 	}
 
-	return pattern2Unitigs;
+	return uniquePatterns;
 }
 
-bool init_sink( const std::string& filename, io::filtering_ostream& os, bool compress=false )
+//compressed outputs are BGZF files (blocked gzip) compressed by gzipThreads threads
+bool init_sink( const std::string& filename, io::filtering_ostream& os, bool compress=false, int gzipThreads=0 )
 {
 	if( compress ) {
-		os.push( io::gzip_compressor() );
-		os.push( io::file_sink(filename+".gz",std::ios::binary) );
+		os.push( BgzfSink(filename+".gz", gzipThreads) );
 	}
 	else {
 		os.push( io::file_sink(filename) );
@@ -209,12 +742,100 @@ bool init_sink( const std::string& filename, io::filtering_ostream& os, bool com
 	return os.is_complete();
 }
 
-void generate_XU(const string &filename, const string &nodesFile, const vector< boost::dynamic_bitset<> > &XU, bool compress=false ) {
-	using bitmap_t = boost::dynamic_bitset<>;
+//appends the decimal text of n to buffer
+static inline void appendNumber(string &buffer, u_int64_t n) {
+    char digits[20];
+    int nbDigits = 0;
+    do {
+        digits[nbDigits++] = '0' + n % 10;
+        n /= 10;
+    } while (n != 0);
+    while (nbDigits > 0)
+        buffer += digits[--nbDigits];
+}
+
+//the Rtab text of the 8 columns of each byte of a pattern, " b0 b1 ... b7" (lowest bit first)
+struct RtabByteText {
+    char text[256][16];
+    RtabByteText() {
+        for (int byte = 0; byte < 256; byte++) {
+            for (int bit = 0; bit < 8; bit++) {
+                text[byte][2*bit] = ' ';
+                text[byte][2*bit+1] = '0' + ((byte >> bit) & 1);
+            }
+        }
+    }
+};
+static const RtabByteText rtabByteText;
+
+//writes nbLines lines to os: blocks of PYSEER_OUTPUT_BLOCK_SIZE lines are formatted in separate buffers by nbCores threads with
+//formatLine(line, buffer), a wave of blocks at a time, and written in order
+//loadWave(begin, end) is called before the lines [begin, end) are formatted, e.g. to read what they need
+template<typename LoadWave, typename FormatLine>
+void writeLinesInParallel(ostream &os, size_t nbLines, int nbCores, LoadWave loadWave, FormatLine formatLine) {
+    Dispatcher dispatcher(nbCores);
+    size_t nbBlocksPerWave = 4 * dispatcher.getExecutionUnitsNumber();
+    vector<string> buffers(nbBlocksPerWave);
+
+    for (size_t waveStart = 0; waveStart < nbLines; waveStart += nbBlocksPerWave * PYSEER_OUTPUT_BLOCK_SIZE) {
+        size_t waveEnd = min<size_t>(nbLines, waveStart + nbBlocksPerWave * PYSEER_OUTPUT_BLOCK_SIZE);
+        loadWave(waveStart, waveEnd);
+        size_t nbBlocks = (waveEnd - waveStart + PYSEER_OUTPUT_BLOCK_SIZE - 1) / PYSEER_OUTPUT_BLOCK_SIZE;
+        Range<size_t>::Iterator blocksIt(0, nbBlocks - 1);
+        dispatcher.iterate(blocksIt, [&](size_t block) {
+            buffers[block].clear();
+            size_t end = min<size_t>(waveEnd, waveStart + (block + 1) * PYSEER_OUTPUT_BLOCK_SIZE);
+            for (size_t line = waveStart + block * PYSEER_OUTPUT_BLOCK_SIZE; line < end; line++)
+                formatLine(line, buffers[block]);
+        }, 1);
+
+        for (size_t block = 0; block < nbBlocks; block++)
+            os.write(buffers[block].data(), buffers[block].size());
+    }
+}
+
+//the text of each strain in unitigs.txt, when present
+vector<string> getStrainTokens() {
+    vector<string> strainTokens;
+    for (const auto &strain : (*strains))
+        strainTokens.push_back(" " + strain.id + ":1");
+    return strainTokens;
+}
+
+//writes the lines of the unitigs of XU to XUFile, reading their sequences from nodesFileReader ("id\tsequence" lines, in the order
+//of the ids)
+void write_XU_lines(ostream &XUFile, istream &nodesFileReader, const BitMatrix &XU, const vector<string> &strainTokens, int nbCores) {
+    vector<string> sequences;
+    size_t firstUnitigOfWave = 0;
+
+    writeLinesInParallel(XUFile, XU.getNbRows(), nbCores, [&](size_t begin, size_t end) {
+        // read the sequences of the unitigs of this wave
+        firstUnitigOfWave = begin;
+        sequences.resize(end - begin);
+        string line;
+        for (auto &seq : sequences) {
+            getline(nodesFileReader, line);
+            seq.assign(line, line.find('\t') + 1, string::npos);
+        }
+    }, [&](size_t i, string &buffer) {
+        // print the unitig sequence
+        buffer += sequences[i - firstUnitigOfWave];
+        buffer += " |";
+
+        // print the strains present
+        // by finding all the set bits
+        BitMatrix::forEachSetBit(XU.getRow(i), XU.getNbWordsPerRow(), [&](size_t pos) {
+            buffer += strainTokens[pos];
+        });
+        buffer += '\n';
+    });
+}
+
+void generate_XU(const string &filename, const string &nodesFile, const BitMatrix &XU, int nbCores, bool compress=false, int gzipThreads=0 ) {
 	//ofstream XUFile;
     //openFileForWriting(filename, XUFile);
 	io::filtering_ostream XUFile;
-	if( !init_sink( filename, XUFile, compress ) ) {
+	if( !init_sink( filename, XUFile, compress, gzipThreads ) ) {
 		cerr << "Unknown error when trying to open file \"" << filename << "\" for output!" << endl;
 		return;
 	}
@@ -222,152 +843,799 @@ void generate_XU(const string &filename, const string &nodesFile, const vector<
     //open file with list of node sequences
     ifstream nodesFileReader;
     openFileForReading(nodesFile, nodesFileReader);
-    int id;
-    string seq;
-
-    for( auto& XUi: XU ) {
-    	// print the unitig sequence
-        nodesFileReader >> id >> seq;
-        XUFile << seq << " |";
-
-        // print the strains present
-        // by finding all the set bits
-        auto pos = XUi.find_first();
-        while( pos != bitmap_t::npos )
-        {
-        	XUFile << " " << (*strains)[pos].id << ":1";
-        	pos = XUi.find_next(pos);
-        }
-        XUFile << endl;
-    }
+    write_XU_lines(XUFile, nodesFileReader, XU, getStrainTokens(), nbCores);
     nodesFileReader.close();
-    //XUFile.close(); // filtering_ostream's destructor does this for us
+    XUFile.reset(); //closes (and finishes) the file
 }
 
 void generate_unique_id_to_original_ids(const string &filename,
-                                        const map< boost::dynamic_bitset<>, vector<int> > &pattern2Unitigs) {
+                                        const UniquePatterns &pattern2Unitigs, int nbCores) {
     ofstream uniqueIdToOriginalIdsFile;
     openFileForWriting(filename, uniqueIdToOriginalIdsFile);
 
     //for each pattern
-    int i=0;
-    for( auto it=pattern2Unitigs.begin(); it!=pattern2Unitigs.end(); ++it, ++i ) {
+    writeLinesInParallel(uniqueIdToOriginalIdsFile, pattern2Unitigs.size(), nbCores, [](size_t, size_t) {}, [&](size_t i, string &buffer) {
         //print the id of this pattern
-        uniqueIdToOriginalIdsFile << i << " = ";
+        appendNumber(buffer, i);
+        buffer += " = ";
 
         //and the unitigs in it
-        for (auto id : it->second)
-            uniqueIdToOriginalIdsFile << id << " ";
-
-        uniqueIdToOriginalIdsFile << endl;
-    }
+        for (u_int64_t j = pattern2Unitigs.offsets[i]; j < pattern2Unitigs.offsets[i+1]; ++j) {
+            appendNumber(buffer, pattern2Unitigs.unitigs[j]);
+            buffer += ' ';
+        }
+        buffer += '\n';
+    });
     uniqueIdToOriginalIdsFile.close();
 }
 
-void generate_XU_unique(const string &filename, const vector< boost::dynamic_bitset<> > &XU,
-                        const map< boost::dynamic_bitset<>, vector<int> > &pattern2Unitigs, bool compress=false ){
+void writeRtabHeader(ostream &XUUnique) {
+    XUUnique << "pattern_id";
+    for (const auto &strain : (*strains))
+        XUUnique << " " << strain.id;
+    XUUnique << '\n';
+}
+
+//appends the Rtab line of a pattern of nbCols strains
+void appendRtabLine(string &buffer, size_t patternId, const u_int64_t *pattern, size_t nbCols) {
+    //print the id of this pattern
+    appendNumber(buffer, patternId);
+
+    //print the pattern, a byte of its words at a time; will produce a *massive* file
+    const size_t nbFullBytes = nbCols / 8, nbBitsInLastByte = nbCols % 8;
+    for (size_t byte = 0; byte < nbFullBytes; ++byte)
+        buffer.append(rtabByteText.text[(pattern[byte >> 3] >> (8 * (byte & 7))) & 255], 16);
+    if (nbBitsInLastByte > 0)
+        buffer.append(rtabByteText.text[(pattern[nbFullBytes >> 3] >> (8 * (nbFullBytes & 7))) & 255], 2 * nbBitsInLastByte);
+    buffer += '\n';
+}
+
+void generate_XU_unique(const string &filename, const BitMatrix &XU,
+                        const UniquePatterns &pattern2Unitigs, int nbCores, bool compress=false, int gzipThreads=0 ){
     //ofstream XUUnique;
     //openFileForWriting(filename, XUUnique);
 	io::filtering_ostream XUUnique;
-	if( !init_sink( filename, XUUnique, compress ) ) {
+	if( !init_sink( filename, XUUnique, compress, gzipThreads ) ) {
 		cerr << "Unknown error when trying to open file \"" << filename << "\" for output!" << endl;
 		return;
 	}
 
     //print the header
-    XUUnique << "pattern_id";
-    for (const auto &strain : (*strains))
-        XUUnique << " " << strain.id;
-    XUUnique << endl;
+    writeRtabHeader(XUUnique);
 
     //for each pattern
-    int i=0;
-    for( auto it=pattern2Unitigs.begin(); it!=pattern2Unitigs.end(); ++it, ++i ) {
-        //print the id of this pattern
-        XUUnique << i;
+    writeLinesInParallel(XUUnique, pattern2Unitigs.size(), nbCores, [](size_t, size_t) {}, [&](size_t i, string &buffer) {
+        appendRtabLine(buffer, i, XU.getRow(pattern2Unitigs.representatives[i]), XU.getNbCols());
+    });
+    XUUnique.reset(); //closes (and finishes) the file
+}
+
+//appends a pattern (the row.size() first bytes of its little-endian words) to a .npy file of patterns
+void writeBinaryPattern(NpyFile &patternsFile, const u_int64_t *pattern, vector<unsigned char> &row) {
+    for (size_t byte = 0; byte < row.size(); byte++)
+        row[byte] = (pattern[byte >> 3] >> (8 * (byte & 7))) & 255;
+    patternsFile.write(row.data(), row.size(), 1);
+}
+
+//writes the binary outputs, to be mapped in memory (e.g. numpy.load(filename, mmap_mode='r')), but for the patterns:
+//unitigs.unique_rows_offsets.npy and unitigs.unique_rows_unitigs.npy: the unitigs of the pattern p are
+//unitigs[offsets[p]:offsets[p+1]] (uint64 and uint32)
+//unitigs.sequences.npy and unitigs.sequence_offsets.npy: the unitig sequences, 2-bit packed (A=0, C=1, G=2, T=3), 4 bases per byte
+//with the first base in the lowest bits; the unitig u is the bases [offsets[u], offsets[u+1]) (uint8 and uint64)
+//unitigs.strains.txt: the strains, in the order of the columns of the patterns
+void generateBinaryUnitigOutputs(const string &outputFolder, const string &nodesFile, size_t nbUnitigs,
+                                 const UniquePatterns &pattern2Unitigs) {
+    ofstream strainsFile;
+    openFileForWriting(outputFolder+string("/unitigs.strains.txt"), strainsFile);
+    for (const auto &strain : (*strains))
+        strainsFile << strain.id << '\n';
+    strainsFile.close();
+
+    //the unitigs of each pattern
+    {
+        NpyFile offsetsFile(outputFolder+string("/unitigs.unique_rows_offsets.npy"), "<u8");
+        offsetsFile.write(pattern2Unitigs.offsets.data(), pattern2Unitigs.offsets.size() * sizeof(u_int64_t), pattern2Unitigs.offsets.size());
+        NpyFile unitigsFile(outputFolder+string("/unitigs.unique_rows_unitigs.npy"), "<u4");
+        unitigsFile.write(pattern2Unitigs.unitigs.data(), pattern2Unitigs.unitigs.size() * sizeof(u_int32_t), pattern2Unitigs.unitigs.size());
+        offsetsFile.close();
+        unitigsFile.close();
+    }
+
+    //the unitig sequences, packed as they are read from the nodes file ("id\tsequence" lines, in the order of the ids)
+    {
+        static const unsigned char codes[4] = {0, 1, 3, 2}; //GATB's encoding (A=0, C=1, T=2, G=3) to A=0, C=1, G=2, T=3
+        ifstream nodesFileReader;
+        openFileForReading(nodesFile, nodesFileReader);
+        NpyFile sequencesFile(outputFolder+string("/unitigs.sequences.npy"), "|u1");
+        NpyFile offsetsFile(outputFolder+string("/unitigs.sequence_offsets.npy"), "<u8");
+        u_int64_t nbBases = 0;
+        offsetsFile.write(&nbBases, sizeof(u_int64_t), 1);
+        vector<unsigned char> packed;
+        string line;
+        for (size_t i = 0; i < nbUnitigs && getline(nodesFileReader, line); i++) {
+            for (size_t pos = line.find('\t') + 1; pos < line.size(); pos++, nbBases++) {
+                if ((nbBases & 3) == 0)
+                    packed.push_back(0);
+                packed.back() |= codes[KMER_STREAMER_NT_CODE[(unsigned char)line[pos]]] << (2 * (nbBases & 3));
+            }
+            offsetsFile.write(&nbBases, sizeof(u_int64_t), 1);
+
+            //write the complete bytes once in a while
+            if (packed.size() >= (1 << 20)) {
+                sequencesFile.write(packed.data(), packed.size() - 1, packed.size() - 1);
+                packed.erase(packed.begin(), packed.end() - 1);
+            }
+        }
+        sequencesFile.write(packed.data(), packed.size(), packed.size());
+        sequencesFile.close();
+        offsetsFile.close();
+        nodesFileReader.close();
+    }
+}
 
-        //print the pattern; will produce a *massive* file
-        const auto& pattern = it->first;
-        for( std::size_t i=0; i<pattern.size(); ++i )
-            XUUnique << " " << pattern[i];
-        XUUnique << endl;
+//writes the binary outputs (see generateBinaryUnitigOutputs), and unitigs.unique_rows.npy: the unique patterns
+//(uint8, nbPatterns x nbStrains/8), bit-packed with the first strain in the lowest bit (numpy.unpackbits(..., axis=1, bitorder='little'))
+void generateBinaryOutputs(const string &outputFolder, const string &nodesFile, const BitMatrix &XU,
+                           const UniquePatterns &pattern2Unitigs) {
+    {
+        NpyFile patternsFile(outputFolder+string("/unitigs.unique_rows.npy"), "|u1", (XU.getNbCols() + 7) / 8);
+        vector<unsigned char> row((XU.getNbCols() + 7) / 8);
+        for (size_t i = 0; i < pattern2Unitigs.size(); i++)
+            writeBinaryPattern(patternsFile, XU.getRow(pattern2Unitigs.representatives[i]), row);
+        patternsFile.close();
     }
-    //XUUnique.close(); // filtering_ostream's destructor does this for us
+    generateBinaryUnitigOutputs(outputFolder, nodesFile, XU.getNbRows(), pattern2Unitigs);
 }
 
 //generate the pyseer input
 void generatePyseerInput (const vector <string> &allReadFilesNames,
                           const string &outputFolder,
-						  const vector< boost::dynamic_bitset<> >& XU,
-                          int nbContigs, bool compress=false ) {
+						  const BitMatrix& XU,
+                          int nbContigs, int nbCores, bool compress=false, int gzipThreads=0, bool binaryOutputs=false ) {
     //Generate the XU (the pyseer input - the unitigs are rows with strains present)
     //XU_unique is XU is in matrix form (for Rtab input) with the duplicated rows removed
     //create the files for pyseer
     {
-        generate_XU(outputFolder+string("/unitigs.txt"), outputFolder+string("/graph.nodes"), XU, compress );
-        auto pattern2Unitigs = getUnitigsWithSamePattern(XU);
+        RunStage XUStage("write_unitigs");
+        generate_XU(outputFolder+string("/unitigs.txt"), outputFolder+string("/graph.nodes"), XU, nbCores, compress, gzipThreads );
+        XUStage.setCount("unitigs", XU.getNbRows());
+        XUStage.stop();
+
+        RunStage dedupStage("dedup");
+        auto pattern2Unitigs = getUnitigsWithSamePattern(XU, nbCores);
         cout << "Number of unique patterns: " << pattern2Unitigs.size() << endl;
-        generate_unique_id_to_original_ids(outputFolder+string("/unitigs.unique_rows_to_all_rows.txt"), pattern2Unitigs);
-        generate_XU_unique(outputFolder+string("/unitigs.unique_rows.Rtab"), XU, pattern2Unitigs, compress );
+        dedupStage.setCount("unitigs", XU.getNbRows());
+        dedupStage.setCount("patterns", pattern2Unitigs.size());
+        dedupStage.stop();
+
+        RunStage uniqueToAllStage("write_unique_rows_to_all_rows");
+        generate_unique_id_to_original_ids(outputFolder+string("/unitigs.unique_rows_to_all_rows.txt"), pattern2Unitigs, nbCores);
+        uniqueToAllStage.setCount("patterns", pattern2Unitigs.size());
+        uniqueToAllStage.stop();
+
+        RunStage XUUniqueStage("write_unique_rows");
+        generate_XU_unique(outputFolder+string("/unitigs.unique_rows.Rtab"), XU, pattern2Unitigs, nbCores, compress, gzipThreads );
+        XUUniqueStage.setCount("patterns", pattern2Unitigs.size());
+        XUUniqueStage.stop();
+
+        if (binaryOutputs) {
+            RunStage binaryStage("write_npy");
+            generateBinaryOutputs(outputFolder, outputFolder+string("/graph.nodes"), XU, pattern2Unitigs);
+            binaryStage.setCount("patterns", pattern2Unitigs.size());
+        }
+    }
+}
+
+//opens an output of a previous run, which may have been gzipped
+string openPreviousOutput(const string &filename, io::filtering_istream &is) {
+    if (boost::filesystem::exists(filename+".gz")) {
+        is.push( io::gzip_decompressor() );
+        is.push( io::file_source(filename+".gz", std::ios::binary) );
+        return filename+".gz";
+    }
+    is.push( io::file_source(filename) );
+    return filename;
+}
+
+//in query mode, the outputs are rewritten with the new strains, while they are the only record of the strains of the previous run
+//Their strains (the header of the unique rows file) and their unitigs file are first copied in the tmp folder, and read from there:
+//a restarted run reuses this copy, as the outputs may have been partly rewritten. The header is copied last, so that it is only
+//there once the copy is complete. Returns the folder of the copy
+string snapshotPreviousOutputs(const string &outputFolder, const string &tmpFolder) {
+    string snapshotFolder = tmpFolder+string("/previous");
+    string headerFilename = snapshotFolder+string("/unitigs.unique_rows.Rtab");
+    if (boost::filesystem::exists(headerFilename))
+        return snapshotFolder;
+    createFolder(snapshotFolder);
+
+    //each file is written aside then renamed, so that a copy interrupted by a crash is never taken for a complete one
+    string XUFilename = outputFolder+string("/unitigs.txt");
+    string extension;
+    if (boost::filesystem::exists(XUFilename+".gz"))
+        extension = ".gz";
+    else if (!boost::filesystem::exists(XUFilename))
+        fatalError("Could not find the unitigs of the previous run: " + XUFilename + "(.gz)");
+    string XUSnapshotFilename = snapshotFolder+string("/unitigs.txt")+extension;
+    boost::filesystem::copy_file(XUFilename+extension, XUSnapshotFilename+".part", boost::filesystem::copy_option::overwrite_if_exists);
+    boost::filesystem::rename(XUSnapshotFilename+".part", XUSnapshotFilename);
+
+    io::filtering_istream rtabFile;
+    string rtabFilename = openPreviousOutput(outputFolder+string("/unitigs.unique_rows.Rtab"), rtabFile);
+    string header;
+    if (!getline(rtabFile, header))
+        fatalError("Could not read the strains of the previous run from " + rtabFilename);
+    ofstream headerFile;
+    openFileForWriting(headerFilename+".part", headerFile);
+    headerFile << header << '\n';
+    headerFile.close();
+    if (!headerFile)
+        fatalError("Error writing " + headerFilename + ".part");
+    boost::filesystem::rename(headerFilename+".part", headerFilename);
+    return snapshotFolder;
+}
+
+//reads back the strains of a previous run from its outputs (the header of the unique rows file)
+vector<Strain> loadPreviousStrains(const string &previousFolder) {
+    vector<Strain> previousStrains;
+    set<string> ids;
+    io::filtering_istream rtabFile;
+    string filename = openPreviousOutput(previousFolder+string("/unitigs.unique_rows.Rtab"), rtabFile);
+    string header, id;
+    getline(rtabFile, header);
+    stringstream ss(header);
+    ss >> id; //pattern_id
+    while (ss >> id) {
+        if (!ids.insert(id).second)
+            fatalError("Duplicated ID in " + filename + ": " + id);
+        previousStrains.push_back(Strain(id, ""));
+    }
+    return previousStrains;
+}
+
+//calls f(strainIndex) for each strain present in a line of the unitigs file of a previous run
+template<typename Function>
+void parsePreviousPatternLine(const string &line, const map<string, int> &idToIndex, const string &filename, Function f) {
+    stringstream ss(line);
+    string token;
+    ss >> token >> token; //the unitig sequence and "|"
+    while (ss >> token) {
+        auto it = idToIndex.find(token.substr(0, token.rfind(':')));
+        if (it == idToIndex.end())
+            fatalError("Unknown strain " + token + " in " + filename + ".");
+        f(it->second);
+    }
+}
+
+//reads back the unitig presence patterns of the strains of a previous run (the first strains of unitigPatterns) from its outputs
+void loadPreviousPatterns(const string &previousFolder, const vector<Strain> &previousStrains, int nbContigs, BitMatrix &unitigPatterns,
+                          bool unitigMajor) {
+    map<string, int> idToIndex;
+    for (size_t i = 0; i < previousStrains.size(); i++)
+        idToIndex[previousStrains[i].id] = i;
+
+    //the presence of the unitigs in each strain is in the unitigs file, one line per unitig
+    io::filtering_istream XUFile;
+    string filename = openPreviousOutput(previousFolder+string("/unitigs.txt"), XUFile);
+    int unitigId = 0;
+    for (string line; getline(XUFile, line); unitigId++) {
+        if (unitigId >= nbContigs)
+            fatalError(filename + " has more unitigs than the graph.");
+        parsePreviousPatternLine(line, idToIndex, filename, [&](int strainIndex) {
+            if (unitigMajor)
+                unitigPatterns.set(unitigId, strainIndex);
+            else
+                unitigPatterns.set(strainIndex, unitigId);
+        });
+    }
+    if (unitigId != nbContigs)
+        fatalError(filename + " does not have one line per unitig of the graph.");
+}
+
+//merges sorted runs of unique patterns (of nbWordsPerRow words, compared from the last word) into sorted unique patterns, given
+//in order to emit(pattern). The runs are read from the heads of the ones with the smallest head, kept in a heap.
+//inputToOutput[run][i] is set to the number of the pattern that came out for the i-th pattern of the run. Returns the nb of patterns
+template<typename Emit>
+size_t mergePatternRuns(const vector<string> &runFilenames, const vector<size_t> &nbPatternsInRun, size_t nbWordsPerRow,
+                        vector< vector<u_int32_t> > &inputToOutput, Emit emit) {
+    const size_t nbRuns = runFilenames.size();
+    vector<ifstream> runFiles(nbRuns);
+    vector<u_int64_t> heads(nbRuns * nbWordsPerRow);
+    auto head = [&](size_t run) { return heads.data() + run * nbWordsPerRow; };
+    auto headLessThan = [&](size_t a, size_t b) {
+        const u_int64_t *headA = head(a), *headB = head(b);
+        for (size_t word = nbWordsPerRow; word > 0; word--)
+            if (headA[word-1] != headB[word-1])
+                return headA[word-1] < headB[word-1];
+        return false;
+    };
+    auto headGreaterThan = [&](size_t a, size_t b) { return headLessThan(b, a); };
+    priority_queue<size_t, vector<size_t>, decltype(headGreaterThan)> smallestHeads(headGreaterThan);
+    auto readHead = [&](size_t run) {
+        if (inputToOutput[run].size() == nbPatternsInRun[run])
+            return;
+        if (!runFiles[run].read((char *)head(run), nbWordsPerRow * sizeof(u_int64_t)))
+            fatalError("Error reading " + runFilenames[run]);
+        smallestHeads.push(run);
+    };
+    for (size_t run = 0; run < nbRuns; run++) {
+        inputToOutput[run].clear();
+        inputToOutput[run].reserve(nbPatternsInRun[run]);
+        openFileForReading(runFilenames[run], runFiles[run]);
+        readHead(run);
+    }
+
+    //the same pattern is in a run at most once, and equal patterns come out together
+    size_t nbPatterns = 0;
+    vector<size_t> runsWithPattern;
+    while (!smallestHeads.empty()) {
+        size_t minRun = smallestHeads.top();
+        smallestHeads.pop();
+        runsWithPattern.assign(1, minRun);
+        while (!smallestHeads.empty() && !headLessThan(minRun, smallestHeads.top())) {
+            runsWithPattern.push_back(smallestHeads.top());
+            smallestHeads.pop();
+        }
+        emit((const u_int64_t *)head(minRun));
+        for (size_t run : runsWithPattern) {
+            inputToOutput[run].push_back(nbPatterns);
+            readHead(run);
+        }
+        nbPatterns++;
+    }
+    return nbPatterns;
+}
+
+//the out-of-core version of the transpose and of generatePyseerInput, for a pattern matrix that does not fit in maxMemory bytes
+//The unitigs x strains matrix is built a block of unitigs at a time, from the unitigs of the strains streamed from their checkpoints
+//(the strains of a previous run, in query mode, from its unitigs file, copied to previousXUFilename). Each block is written to
+//unitigs.txt and deduplicated in memory, and its unique patterns are spilled to disk as a sorted run. Merging the runs dedups the
+//patterns across blocks and numbers them in the same order as in memory, so that the outputs are the same.
+void generatePyseerInputOutOfCore(const vector <string> &allReadFilesNames, const string &outputFolder, const string &checkpointFolder,
+                                  const string &tmpFolder, const string &previousXUFilename, size_t nbPreviousStrains,
+                                  int nbContigs, int nbCores, u_int64_t maxMemory, bool compress=false, int gzipThreads=0,
+                                  bool binaryOutputs=false) {
+    const size_t nbStrains = allReadFilesNames.size();
+    const size_t nbWordsPerRow = (nbStrains + 63) / 64;
+    //half of the memory goes to the block and the dedup of its patterns (~40 bytes per unitig), the rest to the per unitig arrays
+    size_t nbUnitigsPerBlock = max<size_t>(64, (maxMemory / 2) / (nbWordsPerRow * sizeof(u_int64_t) + 40) / 64 * 64);
+    size_t nbBlocks = (nbContigs + nbUnitigsPerBlock - 1) / nbUnitigsPerBlock;
+    cout << "Building the pattern matrix out of core, in " << nbBlocks << " blocks of " << nbUnitigsPerBlock << " unitigs" << endl;
+
+    string runsFolder = tmpFolder+string("/patterns");
+    createFolder(runsFolder);
+    auto getRunFilename = [&](size_t block) { return runsFolder + "/" + to_string(block) + ".run"; };
+
+    vector<CheckpointCursor> cursors;
+    for (size_t i = nbPreviousStrains; i < nbStrains; i++)
+        cursors.push_back(CheckpointCursor(getCheckpointFilename(checkpointFolder, i)));
+    map<string, int> idToIndex;
+    for (size_t i = 0; i < nbPreviousStrains; i++)
+        idToIndex[(*strains)[i].id] = i;
+    io::filtering_istream previousXUFile;
+    if (nbPreviousStrains > 0)
+        openPreviousOutput(previousXUFilename, previousXUFile);
+
+    io::filtering_ostream XUFile;
+    init_sink(outputFolder+string("/unitigs.txt"), XUFile, compress, gzipThreads);
+    ifstream nodesFileReader;
+    openFileForReading(outputFolder+string("/graph.nodes"), nodesFileReader);
+    vector<string> strainTokens = getStrainTokens();
+
+    //the pattern of each unitig, first in its block, then once merged
+    RunStage blocksStage("pattern_blocks");
+    vector<u_int32_t> patternOf(nbContigs);
+    vector<size_t> nbPatternsInBlock(nbBlocks);
+    Dispatcher dispatcher(nbCores);
+    for (size_t block = 0; block < nbBlocks; block++) {
+        size_t begin = block * nbUnitigsPerBlock, end = min<size_t>(nbContigs, begin + nbUnitigsPerBlock);
+        BitMatrix XU(end - begin, nbStrains);
+
+        //fill the block, each thread taking 64 strains (a word of the rows)
+        for (size_t unitigId = begin; unitigId < end && nbPreviousStrains > 0; unitigId++) {
+            string line;
+            if (!getline(previousXUFile, line))
+                fatalError(previousXUFilename + " does not have one line per unitig of the graph in " + outputFolder + ".");
+            parsePreviousPatternLine(line, idToIndex, previousXUFilename, [&](int strainIndex) { XU.set(unitigId - begin, strainIndex); });
+        }
+        if (nbStrains > 0) {
+            Range<size_t>::Iterator wordsIt(0, nbWordsPerRow - 1);
+            dispatcher.iterate(wordsIt, [&](size_t word) {
+                for (size_t i = max(word * 64, nbPreviousStrains); i < min(nbStrains, word * 64 + 64); i++)
+                    cursors[i - nbPreviousStrains].readUntil(end, [&](u_int64_t unitigId) { XU.set(unitigId - begin, i); });
+            }, 1);
+        }
+
+        //write its lines of unitigs.txt
+        write_XU_lines(XUFile, nodesFileReader, XU, strainTokens, nbCores);
+
+        //and spill its unique patterns, sorted
+        UniquePatterns blockPatterns = getUnitigsWithSamePattern(XU, nbCores);
+        nbPatternsInBlock[block] = blockPatterns.size();
+        for (size_t pattern = 0; pattern < blockPatterns.size(); pattern++)
+            for (u_int64_t j = blockPatterns.offsets[pattern]; j < blockPatterns.offsets[pattern+1]; j++)
+                patternOf[begin + blockPatterns.unitigs[j]] = pattern;
+        ofstream runFile;
+        openFileForWriting(getRunFilename(block), runFile);
+        for (size_t pattern = 0; pattern < blockPatterns.size(); pattern++)
+            runFile.write((const char *)XU.getRow(blockPatterns.representatives[pattern]), nbWordsPerRow * sizeof(u_int64_t));
+        runFile.close();
+        if (!runFile)
+            fatalError("Error writing " + getRunFilename(block));
+    }
+    nodesFileReader.close();
+    XUFile.reset(); //closes unitigs.txt
+    cursors.clear();
+    blocksStage.setCount("blocks", nbBlocks);
+    blocksStage.setCount("unitigs", nbContigs);
+    blocksStage.stop();
+
+    //merge the runs, the unique patterns being numbered in the order they come out
+    RunStage mergeStage("merge_patterns");
+    io::filtering_ostream XUUnique;
+    init_sink(outputFolder+string("/unitigs.unique_rows.Rtab"), XUUnique, compress, gzipThreads);
+    writeRtabHeader(XUUnique);
+    shared_ptr<NpyFile> patternsFile;
+    if (binaryOutputs)
+        patternsFile = make_shared<NpyFile>(outputFolder+string("/unitigs.unique_rows.npy"), "|u1", (nbStrains + 7) / 8);
+    vector<unsigned char> binaryRow((nbStrains + 7) / 8);
+
+    //the runs are merged in passes of at most PATTERN_RUNS_MAX_FAN_IN runs, until the last pass writes the patterns
+    //blockPatternToPattern[block] gives the pattern of the current run of the block (runOfBlock) of each pattern of the block
+    vector<string> runFilenames;
+    vector<size_t> nbPatternsInRun(nbPatternsInBlock), runOfBlock(nbBlocks);
+    vector< vector<u_int32_t> > blockPatternToPattern(nbBlocks);
+    for (size_t block = 0; block < nbBlocks; block++) {
+        runFilenames.push_back(getRunFilename(block));
+        runOfBlock[block] = block;
+        for (size_t pattern = 0; pattern < nbPatternsInBlock[block]; pattern++)
+            blockPatternToPattern[block].push_back(pattern);
+    }
+    //merges the runs [first, last) with emit, and maps the patterns of their blocks to those that come out
+    vector< vector<u_int32_t> > runToMerged(nbBlocks);
+    auto mergeRuns = [&](size_t first, size_t last, const std::function<void (const u_int64_t *)> &emit) {
+        vector< vector<u_int32_t> > inputToOutput(last - first);
+        size_t nbMerged = mergePatternRuns(vector<string>(runFilenames.begin() + first, runFilenames.begin() + last),
+                                           vector<size_t>(nbPatternsInRun.begin() + first, nbPatternsInRun.begin() + last),
+                                           nbWordsPerRow, inputToOutput, emit);
+        for (size_t run = first; run < last; run++) {
+            runToMerged[run].swap(inputToOutput[run - first]);
+            boost::filesystem::remove(runFilenames[run]);
+        }
+        return nbMerged;
+    };
+    auto mapBlockPatterns = [&](const vector<size_t> &mergedOfRun) {
+        for (size_t block = 0; block < nbBlocks; block++) {
+            const vector<u_int32_t> &toMerged = runToMerged[runOfBlock[block]];
+            for (auto &pattern : blockPatternToPattern[block])
+                pattern = toMerged[pattern];
+            runOfBlock[block] = mergedOfRun[runOfBlock[block]];
+        }
+    };
+    for (size_t pass = 0; runFilenames.size() > PATTERN_RUNS_MAX_FAN_IN; pass++) {
+        vector<string> mergedFilenames;
+        vector<size_t> nbPatternsMerged, mergedOfRun(runFilenames.size());
+        runToMerged.resize(runFilenames.size());
+        for (size_t first = 0; first < runFilenames.size(); first += PATTERN_RUNS_MAX_FAN_IN) {
+            size_t last = min(runFilenames.size(), first + PATTERN_RUNS_MAX_FAN_IN);
+            string mergedFilename = runsFolder + "/" + to_string(pass) + "." + to_string(mergedFilenames.size()) + ".merged";
+            ofstream mergedFile;
+            openFileForWriting(mergedFilename, mergedFile);
+            nbPatternsMerged.push_back(mergeRuns(first, last, [&](const u_int64_t *pattern) {
+                mergedFile.write((const char *)pattern, nbWordsPerRow * sizeof(u_int64_t));
+            }));
+            mergedFile.close();
+            if (!mergedFile)
+                fatalError("Error writing " + mergedFilename);
+            fill(mergedOfRun.begin() + first, mergedOfRun.begin() + last, mergedFilenames.size());
+            mergedFilenames.push_back(mergedFilename);
+        }
+        mapBlockPatterns(mergedOfRun);
+        runFilenames.swap(mergedFilenames);
+        nbPatternsInRun.swap(nbPatternsMerged);
+    }
+
+    //the last pass: the unique patterns are written as they come out
+    string buffer;
+    runToMerged.resize(runFilenames.size());
+    u_int32_t nbPatterns = 0;
+    mergeRuns(0, runFilenames.size(), [&](const u_int64_t *pattern) {
+        appendRtabLine(buffer, nbPatterns++, pattern, nbStrains);
+        if (buffer.size() >= (1 << 20)) {
+            XUUnique.write(buffer.data(), buffer.size());
+            buffer.clear();
+        }
+        if (binaryOutputs)
+            writeBinaryPattern(*patternsFile, pattern, binaryRow);
+    });
+    mapBlockPatterns(vector<size_t>(runFilenames.size(), 0));
+    XUUnique.write(buffer.data(), buffer.size());
+    XUUnique.reset();
+    if (binaryOutputs)
+        patternsFile->close();
+    patternsFile.reset();
+    boost::filesystem::remove_all(runsFolder);
+    cout << "Number of unique patterns: " << nbPatterns << endl;
+    mergeStage.setCount("patterns", nbPatterns);
+    mergeStage.stop();
+
+    //the unitigs of each pattern, in increasing order
+    UniquePatterns pattern2Unitigs;
+    pattern2Unitigs.offsets.resize(nbPatterns + 1, 0);
+    for (size_t unitigId = 0; unitigId < (size_t)nbContigs; unitigId++) {
+        patternOf[unitigId] = blockPatternToPattern[unitigId / nbUnitigsPerBlock][patternOf[unitigId]];
+        pattern2Unitigs.offsets[patternOf[unitigId] + 1]++;
+    }
+    for (size_t pattern = 0; pattern < nbPatterns; pattern++)
+        pattern2Unitigs.offsets[pattern + 1] += pattern2Unitigs.offsets[pattern];
+    pattern2Unitigs.unitigs.resize(nbContigs);
+    {
+        vector<u_int64_t> next(pattern2Unitigs.offsets.begin(), pattern2Unitigs.offsets.end() - 1);
+        for (size_t unitigId = 0; unitigId < (size_t)nbContigs; unitigId++)
+            pattern2Unitigs.unitigs[next[patternOf[unitigId]]++] = unitigId;
+    }
+    for (size_t pattern = 0; pattern < nbPatterns; pattern++)
+        pattern2Unitigs.representatives.push_back(pattern2Unitigs.unitigs[pattern2Unitigs.offsets[pattern]]);
+
+    RunStage uniqueToAllStage("write_unique_rows_to_all_rows");
+    generate_unique_id_to_original_ids(outputFolder+string("/unitigs.unique_rows_to_all_rows.txt"), pattern2Unitigs, nbCores);
+    uniqueToAllStage.setCount("patterns", nbPatterns);
+    uniqueToAllStage.stop();
+    if (binaryOutputs) {
+        RunStage binaryStage("write_npy");
+        generateBinaryUnitigOutputs(outputFolder, outputFolder+string("/graph.nodes"), nbContigs, pattern2Unitigs);
+        binaryStage.setCount("patterns", nbPatterns);
     }
 }
 
 void map_reads::execute ()
 {
-	using bitmap_container_t = typename MapAndPhase::bitmap_container_t;
-
 	//get the parameters
     string outputFolder = stripLastSlashIfExists(getInput()->getStr(STR_OUTPUT));
     string tmpFolder = outputFolder+string("/tmp");
-    string longReadsFile = tmpFolder+string("/readsFile");
     int nbCores = getInput()->getInt(STR_NBCORES);
     const bool compress = getInput()->get(STR_GZIP);
+    const int gzipThreads = getInput()->getInt(STR_GZIP_THREADS);
+    bool unitigJump = getInput()->get(STR_UNITIG_JUMP);
+    const bool unitigMajor = getInput()->get(STR_UNITIG_MAJOR);
+    const bool binaryOutputs = getInput()->get(STR_NPY);
+    const u_int64_t maxMemory = (u_int64_t)getInput()->getInt(STR_MATRIX_MAX_MEMORY) << 20;
+
+    //a shard only maps its range of strains: their checkpoints are then merged by the merge subcommand
+    int shardIndex = 0, nbShards = 1;
+    const string shard = getInput()->getStr(STR_SHARD);
+    const bool sharded = !shard.empty();
+    if (sharded) {
+        if (query || merge || graph != NULL)
+            fatalError(string(STR_SHARD) + " can only be used with the map subcommand.");
+        char slash = 0;
+        stringstream ss(shard);
+        if (!(ss >> shardIndex >> slash >> nbShards) || slash != '/' || !ss.eof() || nbShards < 1 || shardIndex < 0 || shardIndex >= nbShards)
+            fatalError("Invalid " + string(STR_SHARD) + " " + shard + ": it should be i/N, with 0 <= i < N.");
+    }
+
+    //when run as a separate stage (the map subcommand), the graph and the kmer to unitig index are loaded from the output folder
+    //merging the shards needs neither, only the checkpoints of the strains
+    if (graph == NULL) {
+        cerr << (query ? "Adding strains to the DBG in " : merge ? "Merging the mapping shards in " : "Mapping strains on the DBG in ")
+             << outputFolder << "..." << endl;
+        checkParametersMapReads(this, query);
+        createFolder(tmpFolder);
+        if (!merge) {
+            graph = new Graph(gatb::core::debruijn::impl::Graph::load(outputFolder+string("/graph")));
+            nodeIdToUnitigId = new UnitigIndex(outputFolder+string("/graph.unitig_index"));
+            if (nodeIdToUnitigId->getKmerSize() != (int)graph->getKmerSize())
+                fatalError("The unitig index in " + outputFolder + " does not match the graph.");
+        }
+    }
+    if (merge)
+        unitigJump = false;
+    if (unitigJump && nodeIdToUnitigId->isLean()) {
+        cerr << "Warning: the unitig index was built without " << STR_UNITIG_JUMP << " and has no kmer positions. Mapping without it." << endl;
+        unitigJump = false;
+    }
 
     //get the nbContigs
     int nbContigs = getNbLinesInFile(outputFolder+string("/graph.nodes"));
 
+    //load the unitig sequences if the mapping should follow them, or check that the kmers are really in the graph
+    vector<string> unitigSequences;
+    if (unitigJump || query)
+        unitigSequences = getUnitigSequencesFromNodesFile(outputFolder+string("/graph.nodes"));
+
+    //in query mode, the strains already in the outputs are kept as they are, and only the new ones are mapped
+    //(they are read from a copy of the outputs, which are rewritten)
+    vector<Strain> previousStrains;
+    size_t nbPreviousStrains = 0;
+    string previousFolder;
+    if (query) {
+        previousFolder = snapshotPreviousOutputs(outputFolder, tmpFolder);
+        previousStrains = loadPreviousStrains(previousFolder);
+        nbPreviousStrains = previousStrains.size();
+        for (const auto &strain : *strains) {
+            for (const auto &previousStrain : previousStrains)
+                if (strain.id == previousStrain.id)
+                    fatalError("Strain " + strain.id + " is already in " + outputFolder + ".");
+        }
+        strains->insert(strains->begin(), previousStrains.begin(), previousStrains.end());
+        cout << "Adding " << strains->size() - nbPreviousStrains << " strains to the " << nbPreviousStrains << " already in " << outputFolder << "." << endl;
+    }
+
     //Do the Mapping
     //Maps all the reads back to the graph
 
-    //get all the read files' name
-    vector <string> allReadFilesNames = getVectorStringFromFile(longReadsFile);
-
-    // use bitmaps/bitsets in order to curb memory use
-    bitmap_container_t allUnitigPatterns; allUnitigPatterns.resize(allReadFilesNames.size());
-
-    // We create an iterator over an integer range
-    Range<int>::Iterator allReadFilesNamesIt(0, allReadFilesNames.size() - 1);
+    //get all the read files' name (the strains of a previous run have none)
+    vector <string> allReadFilesNames;
+    for (const auto &strain : *strains)
+        allReadFilesNames.push_back(strain.path);
+
+    // use a bit matrix (strains x unitigs) in order to curb memory use
+    // in unitig-major mode, the presence is directly set in the unitigs x strains matrix, which then needs no transpose
+    // if the matrix (twice, to transpose it) does not fit in the memory budget, the patterns are only kept in the strain checkpoints
+    // a shard writes no outputs: it keeps its patterns in the checkpoints only
+    PatternStorage patternStorage = unitigMajor ? UNITIG_MAJOR : STRAIN_MAJOR;
+    u_int64_t matrixSize = (u_int64_t)nbContigs * ((allReadFilesNames.size() + 63) / 64) * sizeof(u_int64_t);
+    if (sharded) {
+        patternStorage = ON_DISK;
+    }
+    else if (maxMemory > 0 && matrixSize * (unitigMajor ? 1 : 2) > maxMemory) {
+        patternStorage = ON_DISK;
+        cout << "The pattern matrix (" << (matrixSize >> 20) << " MB) does not fit in " << STR_MATRIX_MAX_MEMORY << ": building it out of core." << endl;
+    }
+    BitMatrix allUnitigPatterns;
+    if (patternStorage == UNITIG_MAJOR)
+        allUnitigPatterns = BitMatrix(nbContigs, allReadFilesNames.size());
+    else if (patternStorage == STRAIN_MAJOR)
+        allUnitigPatterns = BitMatrix(allReadFilesNames.size(), nbContigs);
+    vector< vector<u_int64_t> > strainUnitigIds(patternStorage != STRAIN_MAJOR ? allReadFilesNames.size() : 0);
+    if (query && patternStorage != ON_DISK)
+        loadPreviousPatterns(previousFolder, previousStrains, nbContigs, allUnitigPatterns, unitigMajor);
+
+    //resume from the strains already mapped by a previous (interrupted) run
+    string checkpointFolder = tmpFolder+string("/mapping");
+    createFolder(checkpointFolder);
+    vector<int> strainsToMap;
+    vector<u_int64_t> unitigIds;
+    size_t firstStrain = nbPreviousStrains + (allReadFilesNames.size() - nbPreviousStrains) * shardIndex / nbShards;
+    size_t lastStrain = nbPreviousStrains + (allReadFilesNames.size() - nbPreviousStrains) * (shardIndex + 1) / nbShards;
+    for (size_t i = firstStrain; i < lastStrain; i++) {
+        if (!loadCheckpoint(getCheckpointFilename(checkpointFolder, i), allReadFilesNames[i], nbContigs, unitigIds)) {
+            strainsToMap.push_back(i);
+            continue;
+        }
+        for (u_int64_t unitigId : unitigIds) {
+            if (patternStorage == UNITIG_MAJOR)
+                allUnitigPatterns.set(unitigId, i);
+            else if (patternStorage == STRAIN_MAJOR)
+                allUnitigPatterns.set(i, unitigId);
+        }
+    }
+    if (merge && !strainsToMap.empty())
+        fatalError("Strain " + (*strains)[strainsToMap[0]].id + " (and " + to_string(strainsToMap.size() - 1) +
+                   " others) was not mapped by any shard: all shards must be done before merging them.");
+    if (sharded)
+        cout << "Shard " << shardIndex << "/" << nbShards << ": strains " << firstStrain << " to " << lastStrain - 1 << "." << endl;
+    if (strainsToMap.size() < lastStrain - firstStrain && !merge)
+        cout << "Resuming mapping: " << lastStrain - firstStrain - strainsToMap.size() << " strains were already mapped." << endl;
+    vector<size_t> nbChunksLeft(allReadFilesNames.size(), 0);
 
     //synchronizer object
     ISynchronizer *synchro = System::thread().newSynchronizer();
 
     // We create a dispatcher configured for 'nbCores' cores.
     Dispatcher dispatcher(nbCores, 1);
+    nbCores = dispatcher.getExecutionUnitsNumber(); //0 means all cores
+
+    // Checking that the kmers of new strains are really in the graph needs their positions in the unitigs: a lean index
+    // (the default) is completed in memory from the unitig sequences
+    if (query && nodeIdToUnitigId->isLean()) {
+        cout << "Adding the kmer positions to the lean unitig index, to check the kmers of the new strains..." << endl;
+        int kmerSize = graph->getKmerSize();
+        UnitigIndex *fullIndex = NULL;
+        if (kmerSize < KMER_SPAN(0))  {  fullIndex = buildFullUnitigIndex<KMER_SPAN(0)>(*graph, *nodeIdToUnitigId, unitigSequences, dispatcher); }
+        else if (kmerSize < KMER_SPAN(1))  {  fullIndex = buildFullUnitigIndex<KMER_SPAN(1)>(*graph, *nodeIdToUnitigId, unitigSequences, dispatcher); }
+        else if (kmerSize < KMER_SPAN(2))  {  fullIndex = buildFullUnitigIndex<KMER_SPAN(2)>(*graph, *nodeIdToUnitigId, unitigSequences, dispatcher); }
+        else if (kmerSize < KMER_SPAN(3))  {  fullIndex = buildFullUnitigIndex<KMER_SPAN(3)>(*graph, *nodeIdToUnitigId, unitigSequences, dispatcher); }
+        else { throw gatb::core::system::Exception ("Mapping failure because of unhandled kmer size %d", kmerSize); }
+        delete nodeIdToUnitigId;
+        nodeIdToUnitigId = fullIndex;
+    }
 
-    cout << "[Starting mapping process... ]" << endl;
-    cout << "Using " << nbCores << " cores to map " << allReadFilesNames.size() << " read files." << endl;
-
-    // We iterate the range.  NOTE: we could also use lambda expression (easing the code readability)
-    uint64_t nbOfReadsProcessed = 0;
-    dispatcher.iterate(allReadFilesNamesIt,
-                       MapAndPhase(allReadFilesNames, *graph, nbOfReadsProcessed, synchro,
-                    		   allUnitigPatterns, *nodeIdToUnitigId, nbContigs));
-
-    cout << endl << "[Mapping process finished!]" << endl;
+    // The reader threads load (parse and decompress) the strain files ahead of the mapping threads, which then only map
+    // Without them, the mapping threads load the files. The readers are taken out of the cores, at most one in four of them
+    // (so there are none below 4 cores)
+    int nbReaderThreads = getInput()->getInt(STR_READER_THREADS);
+    size_t readAhead = max<int64_t>(1, getInput()->getInt(STR_READ_AHEAD));
+    if (nbReaderThreads < 0)
+        fatalError(string(STR_READER_THREADS) + " must be positive.");
+    nbReaderThreads = min(nbReaderThreads, nbCores / 4);
+    int nbMappingThreads = nbCores - nbReaderThreads;
+    Dispatcher mappingDispatcher(nbCores, 1);
+
+    // We create an iterator over an integer range, one for each mapping (and reader) thread
+    Range<int>::Iterator threadsIt(0, nbCores - 1);
+
+    // The strains are read from the sequence cache built along with the graph, if there is one (the strains it does not have,
+    // e.g. when adding new strains, are parsed from their files)
+    string sequenceCacheFilename = tmpFolder+string("/sequences.cache");
+    unique_ptr<SequenceCache> sequenceCache;
+    if (!merge && SequenceCache::exists(sequenceCacheFilename))
+        sequenceCache.reset(new SequenceCache(sequenceCacheFilename));
+
+    // The threads share the files, and the chunks of the files, through the chunk queue
+    ChunkQueue chunkQueue(strainsToMap, nbReaderThreads > 0 ? readAhead : 0);
+    NovelKmersReport novelKmersReport(allReadFilesNames.size());
+    if (!merge) {
+        RunStage mappingStage("mapping");
+        cout << "[Starting mapping process... ]" << endl;
+        cout << "Using " << nbCores << " cores to map " << strainsToMap.size() << " read files";
+        if (nbReaderThreads > 0)
+            cout << " (" << nbMappingThreads << " mapping the files read by the " << nbReaderThreads << " others)";
+        cout << "." << endl;
+
+        // The threads count what they map without locking, and the progress is reported by a thread of its own
+        // (in the output, and in a metrics file that can be polled while the mapping runs, one per shard as they run at the same time)
+        double progressInterval = getInput()->getDouble(STR_PROGRESS_INTERVAL);
+        string progressFilename = outputFolder + (sharded ? string("/progress.shard")+to_string(shardIndex) : string("/progress")) + string(".json");
+        ProgressReporter progress(nbCores, strainsToMap.size(), max(0.0, progressInterval), progressFilename);
+        progress.start();
+        mappingDispatcher.iterate(threadsIt,
+                           MapAndPhase(allReadFilesNames, sequenceCache.get(), nbMappingThreads, *graph, progress, synchro,
+                        		   allUnitigPatterns, patternStorage, strainUnitigIds, *nodeIdToUnitigId, unitigSequences.empty() ? NULL : &unitigSequences, unitigJump,
+                        		   nbContigs, chunkQueue, nbChunksLeft, checkpointFolder, query ? &novelKmersReport : NULL));
+        progress.stop();
+        cout << "[Mapping process finished!]" << endl;
+        ProgressReporter::Totals totals = progress.getTotals();
+        mappingStage.setCount("strains", strainsToMap.size());
+        mappingStage.setCount("reads", totals.reads);
+        mappingStage.setCount("kmers", totals.kmers);
+        mappingStage.setCount("unitigs", nbContigs);
+    }
+    if (sharded) {
+        //the outputs are written by the merge subcommand, once all shards are done
+        cout << "Shard " << shardIndex << "/" << nbShards << " done. Once all shards are done, run the merge subcommand on " << outputFolder << "." << endl;
+        RunStats::save(outputFolder+string("/run_stats.shard")+to_string(shardIndex)+string(".json"));
+        delete graph;
+        return;
+    }
+    if (query) {
+        //the kmers of the new strains that are not in the graph are reported, but not added to it
+        novelKmersReport.save(outputFolder, graph->getKmerSize());
+        cout << "Kmers of the new strains not in the graph are reported in " << outputFolder << "/novel_kmers.txt and "
+             << outputFolder << "/novel_sequences.fasta" << endl;
+    }
+    unitigSequences.clear(); vector<string>(unitigSequences).swap(unitigSequences); // release memory
 
     // allUnitigPatterns has all samples/strains over the first dimension and
-    // unitig presense patterns over the second dimension (in bitsets).
-    // Here we transpose the matrix, while consuming it in order to gradually reduce memory footprint.
+    // unitig presense patterns over the second dimension (in bitsets), unless it was filled in unitig-major mode or kept on disk.
+    // Here we transpose the matrix by tiles, while consuming it by blocks of 64 strains in order to gradually reduce memory footprint.
     // For larger data sets this pattern accounting will dominate our memory footprint; overall memory consumption will peak here.
     // Peak memory use occurs at the start and will be twice the matrix size (= 2 * (nbContigs*strains->size()/8) bytes).
-    cout << "[Transpose pattern matrix..]" << endl;
-    auto XU = transposeXU( allUnitigPatterns ); // this will consume allUnitigPatterns while transposing
-    allUnitigPatterns.resize(0); bitmap_container_t(allUnitigPatterns).swap(allUnitigPatterns); // release memory
-
-    //generate the pyseer input
     cout << "[Generating pyseer input]..." << endl;
-    generatePyseerInput(allReadFilesNames, outputFolder, XU, nbContigs, compress);
+    if (patternStorage == ON_DISK) {
+        //the unitigs file of the previous run is read from its copy in the tmp folder while the new one is written
+        string previousXUFilename = previousFolder+string("/unitigs.txt");
+        generatePyseerInputOutOfCore(allReadFilesNames, outputFolder, checkpointFolder, tmpFolder, previousXUFilename, nbPreviousStrains,
+                                     nbContigs, nbCores, maxMemory, compress, gzipThreads, binaryOutputs);
+    }
+    else {
+        BitMatrix XU;
+        if (patternStorage == UNITIG_MAJOR) {
+            XU = std::move(allUnitigPatterns);
+        }
+        else {
+            cout << "[Transpose pattern matrix..]" << endl;
+            RunStage transposeStage("transpose");
+            XU = transposeXU( allUnitigPatterns, nbCores ); // this will consume allUnitigPatterns while transposing
+            allUnitigPatterns = BitMatrix(); // release memory
+            transposeStage.setCount("unitigs", nbContigs);
+            transposeStage.setCount("strains", allReadFilesNames.size());
+        }
+
+        //generate the pyseer input
+        generatePyseerInput(allReadFilesNames, outputFolder, XU, nbContigs, nbCores, compress, gzipThreads, binaryOutputs);
+    }
     cout << "[Generating pyseer input] - Done!" << endl;
+    RunStats::save(outputFolder+string("/run_stats.json"));
 
     //cout << "Number of unique patterns: " << getNbLinesInFile(outputFolder+string("/unitigs.unique_rows.Rtab")) << endl;
 
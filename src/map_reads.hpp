@@ -30,8 +30,11 @@
 #ifndef _TOOL_map_reads_HPP_
 #define _TOOL_map_reads_HPP_
 #include <cstdlib>
+#include <vector>
+#include <string>
 /********************************************************************************/
 #include <gatb/gatb_core.hpp>
+#include "BitMatrix.h"
 /********************************************************************************/
 
 class map_reads : public Tool
@@ -39,7 +42,9 @@ class map_reads : public Tool
 public:
 
     // Constructor
-    map_reads ();
+    // query: add the strains to the outputs of a previous run instead of writing them from scratch
+    // merge: write the outputs from the checkpoints of the strains mapped by the shards of a run (see STR_SHARD), mapping nothing
+    map_reads (bool query=false, bool merge=false);
 
     // Actual job done by the tool is here
     void execute ();
@@ -52,8 +57,26 @@ public:
             std::exit(1);
         return toReturn;
     }
+
+private:
+    bool query, merge;
 };
 
+//the unitigs grouped by presence pattern (row of XU), in CSR form: the unitigs of the pattern p are
+//unitigs[offsets[p]..offsets[p+1]), in increasing order, and representatives[p] is the first of them
+struct UniquePatterns {
+    std::vector<u_int32_t> representatives;
+    std::vector<u_int64_t> offsets;
+    std::vector<u_int32_t> unitigs;
+
+    size_t size() const { return representatives.size(); }
+};
+
+//the kernels of the pattern matrix, also run by the benchmarks
+BitMatrix transposeXU( BitMatrix &XUT, int nbCores );
+UniquePatterns getUnitigsWithSamePattern (const BitMatrix &XU, int nbCores);
+void appendRtabLine(std::string &buffer, size_t patternId, const u_int64_t *pattern, size_t nbCols);
+
 /********************************************************************************/
 
 #endif
@@ -7,11 +7,124 @@
  */
 
 #include <boost/program_options.hpp>
+#include <limits>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <deque>
 #include "version.h"
 #include "node_dists.hpp"
 
 namespace po = boost::program_options; // Save some typing
 
+// Formats the nbItems items with nbThreads threads and writes them to out in the order of the items. format(item, buffer,
+// threadIndex, flush) appends the output of the item to buffer, and can call flush() to hand what it appended so far to the
+// writer (e.g. every output_piece_size bytes, for a large item). The pieces of the item being written are written as they come,
+// and those of the next ones (at most a few items per thread ahead) are kept while they add up to at most max_buffered_bytes:
+// past that, a thread waits for its item to be the one written before handing over more.
+const size_t output_piece_size = 1 << 20;
+const size_t max_buffered_bytes = 64 << 20;
+
+template<typename Format>
+void write_in_order(const size_t nbItems, const int nbThreads, Format format, ostream& out)
+{
+    const size_t window = 4 * nbThreads;
+    struct Slot
+    {
+        deque<string> pieces;
+        bool done = false;
+    };
+    vector<Slot> slots(window);
+    size_t nextItem = 0, nbWritten = 0, bufferedBytes = 0;
+    mutex bufferMutex;
+    condition_variable pieceReady, pieceWritten;
+
+    auto formatter = [&](const int threadIndex)
+    {
+        string buffer;
+        size_t item = 0;
+        auto hand_over = [&](const bool done)
+        {
+            unique_lock<mutex> lock(bufferMutex);
+            Slot& slot = slots[item % window];
+            bufferedBytes += buffer.size();
+            slot.pieces.push_back(string());
+            slot.pieces.back().swap(buffer);
+            slot.done = done;
+            pieceReady.notify_one();
+            if (!done)
+            {
+                pieceWritten.wait(lock, [&]() { return item == nbWritten || bufferedBytes <= max_buffered_bytes; });
+            }
+        };
+        const function<void()> flush = [&]() { hand_over(false); };
+        while (true)
+        {
+            {
+                unique_lock<mutex> lock(bufferMutex);
+                pieceWritten.wait(lock, [&]() { return nextItem >= nbItems ||
+                                                       (nextItem < nbWritten + window && bufferedBytes <= max_buffered_bytes); });
+                if (nextItem >= nbItems)
+                {
+                    return;
+                }
+                item = nextItem++;
+            }
+            buffer.clear();
+            format(item, buffer, threadIndex, flush);
+            hand_over(true);
+        }
+    };
+    vector<thread> threads;
+    for (int threadIndex = 0; threadIndex < nbThreads; threadIndex++)
+    {
+        threads.push_back(thread(formatter, threadIndex));
+    }
+
+    string piece;
+    while (nbWritten < nbItems)
+    {
+        {
+            unique_lock<mutex> lock(bufferMutex);
+            Slot& slot = slots[nbWritten % window];
+            pieceReady.wait(lock, [&]() { return !slot.pieces.empty(); });
+            piece.swap(slot.pieces.front());
+            slot.pieces.pop_front();
+            bufferedBytes -= piece.size();
+            if (slot.done && slot.pieces.empty())
+            {
+                slot.done = false;
+                nbWritten++;
+            }
+        }
+        pieceWritten.notify_all();
+        out.write(piece.data(), piece.size());
+    }
+    for (auto& formatterThread : threads)
+    {
+        formatterThread.join();
+    }
+}
+
+// Reads the sequences of a file, one per line
+vector<string> read_sequences(const string& filename)
+{
+    ifstream sequenceIst(filename.c_str());
+    if (!sequenceIst)
+    {
+        throw std::runtime_error("Could not open node file " + filename + "\n");
+    }
+
+    vector<string> sequences;
+    string sequence;
+    while (sequenceIst >> sequence)
+    {
+        sequences.push_back(sequence);
+    }
+    return sequences;
+}
+
 // Use boost::program_options to parse command line input
 int parseCommandLine (int argc, char *argv[], po::variables_map& vm)
 {
@@ -31,17 +144,23 @@ int parseCommandLine (int argc, char *argv[], po::variables_map& vm)
     ("source", po::value<string>(), "Sequence of source node")
     ("source-list", po::value<string>(), "File containing sequences of source nodes")
     ("target", po::value<string>(), "Sequence of target node")
-    ("all", "Generate distances to all other unitigs");
+    ("target-list", po::value<string>(), "File containing sequences of target nodes")
+    ("all", "Generate distances to all other unitigs")
+    ("max-dist", po::value<int>(), "Only report distances up to this (the searches stop there)")
+    ("ids", "Write node ids rather than sequences");
 
    po::options_description extend("Extending options");
    extend.add_options()
     ("unitigs", po::value<string>(), "File containing unitigs to extend")
     ("length", po::value<int>()->default_value(100), "Maximum extension length")
-    ("repeats", "Allow loops in extensions");
+    ("repeats", "Allow loops in extensions")
+    ("max-paths", po::value<size_t>()->default_value(10000), "Maximum number of paths written per unitig")
+    ("max-path-memory", po::value<size_t>()->default_value(256), "Maximum size of the paths of a unitig, in MB");
 
    po::options_description other("Other options");
    other.add_options()
     ("mode", po::value<string>(), "Mode of operation")
+    ("threads", po::value<int>()->default_value(1), "Number of threads")
     ("version", "prints version and exits")
     ("help,h", "full help message");
 
@@ -59,6 +178,7 @@ int parseCommandLine (int argc, char *argv[], po::variables_map& vm)
       {
          cerr << "cdbg-ops dist: Calculate distance between two nodes" << endl;
          cerr << "cdbg-ops extend: Extend sequence around a node by finding paths through it" << endl;
+         cerr << "cdbg-ops cache: Convert the graph files to the binary cache read by the other modes" << endl;
          cerr << all << endl;
          failed = 1;
       }
@@ -74,9 +194,9 @@ int parseCommandLine (int argc, char *argv[], po::variables_map& vm)
 
          // Check input files exist, and can stat
          if (vm.count("mode") != 1 ||
-              (vm["mode"].as<string>() != "dist" && vm["mode"].as<string>() != "extend"))
+              (vm["mode"].as<string>() != "dist" && vm["mode"].as<string>() != "extend" && vm["mode"].as<string>() != "cache"))
          {
-            cerr << "Possible modes are 'dist' or 'extend" << endl;
+            cerr << "Possible modes are 'dist', 'extend' or 'cache'" << endl;
             failed = 1;
          }
       }
@@ -98,12 +218,16 @@ int parseCommandLine (int argc, char *argv[], po::variables_map& vm)
 // Simple example program
 int main (int argc, char *argv[])
 {
+    // The outputs are only written through cout
+    std::ios::sync_with_stdio(false);
+
     // Do parsing and checking of command line params
     po::variables_map vm;
     if (argc == 1)
     {
         cerr << "cdbg-ops dist --source AATCG --target TTGC" << endl;
         cerr << "cdbg-ops extend --unitigs significant_hits.txt" << endl;
+        cerr << "cdbg-ops cache --graph output/graph" << endl;
         return 1;
     }
     else if (parseCommandLine(argc, argv, vm))
@@ -129,6 +253,13 @@ int main (int argc, char *argv[])
     {
         cerr << "Must give input graph with --graph or --nodes and --edges" << endl;
     }
+
+    // Cache mode: the text files are parsed once, and the next runs map the cache (it is also written by the first run of any mode)
+    if (vm["mode"].as<string>() == "cache")
+    {
+        cerr << "Graph cache in " << Cdbg::build_cache(nodes, edges) << endl;
+        return 0;
+    }
     Cdbg graphIn(nodes, edges);
 
     // Distance mode
@@ -136,7 +267,7 @@ int main (int argc, char *argv[])
     {
         cerr << "Calculating distances from node" << endl;
 
-        if (!vm.count("target") && !vm.count("all"))
+        if (!vm.count("target") && !vm.count("target-list") && !vm.count("all"))
         {
             throw std::runtime_error("Need to provide a target or all in dist mode");
         }
@@ -144,19 +275,7 @@ int main (int argc, char *argv[])
         vector<string> sources;
         if (vm.count("source-list"))
         {
-            ifstream sourceIst(vm["source-list"].as<string>().c_str());
-            if (!sourceIst)
-            {
-                throw std::runtime_error("Could not open node file " + vm["source-list"].as<string>() + "\n");
-            }
-
-            string sequence;
-            while (sourceIst >> sequence)
-            {
-                sources.push_back(sequence);
-            }
-
-            sourceIst.close();
+            sources = read_sequences(vm["source-list"].as<string>());
         }
         else if (vm.count("source"))
         {
@@ -167,22 +286,104 @@ int main (int argc, char *argv[])
             throw std::runtime_error("Need to provide a source in dist mode");
         }
 
-        cout << "Source\tTarget\tDistance" << endl;
-        for (auto it = sources.begin(); it != sources.end(); it++)
+        // The targets are flagged, so that each search stops once they are all settled
+        const bool all = vm.count("all");
+        vector<string> targets;
+        if (vm.count("target-list"))
+        {
+            targets = read_sequences(vm["target-list"].as<string>());
+        }
+        else if (vm.count("target"))
         {
-            vector<int> dists = graphIn.node_distance(*it);
-            if (vm.count("all"))
+            targets.push_back(vm["target"].as<string>());
+        }
+        vector<int> sourceIds, targetIds;
+        for (const auto& source : sources)
+        {
+            sourceIds.push_back(graphIn.get_vertex(source));
+        }
+        vector<char> isTarget(all ? 0 : graphIn.nb_nodes(), 0);
+        size_t nbTargets = 0;
+        for (const auto& target : targets)
+        {
+            targetIds.push_back(graphIn.get_vertex(target));
+            if (!all && !isTarget[targetIds.back()])
             {
-                for (size_t i = 0; i < dists.size(); i++)
+                isTarget[targetIds.back()] = 1;
+                nbTargets++;
+            }
+        }
+
+        // Without a maximum distance, all the distances are written (INT_MAX if the node is not reachable);
+        // with one, only those up to it
+        const bool bounded = vm.count("max-dist");
+        const int maxDist = bounded ? vm["max-dist"].as<int>() : numeric_limits<int>::max();
+        const bool ids = vm.count("ids");
+        const int nbThreads = max(1, vm["threads"].as<int>());
+        vector<DistanceSearch> searches(nbThreads);
+        auto append_node = [&](const int id, string& buffer)
+        {
+            if (ids)
+            {
+                buffer += to_string(id);
+            }
+            else
+            {
+                graphIn.append_node_seq(id, buffer);
+            }
+        };
+
+        cout << "Source\tTarget\tDistance\n";
+        // (a source with all the nodes as targets has a line per node: its lines are written by pieces as they come)
+        write_in_order(sourceIds.size(), nbThreads, [&](const size_t sourceIndex, string& buffer, const int threadIndex,
+                                                        const function<void()>& flush)
+        {
+            DistanceSearch& search = searches[threadIndex];
+            graphIn.node_distance(sourceIds[sourceIndex], search, maxDist, all ? NULL : &isTarget, nbTargets);
+
+            string source;
+            append_node(sourceIds[sourceIndex], source);
+            source += '\t';
+            auto append_distance = [&](const int id)
+            {
+                buffer += source;
+                append_node(id, buffer);
+                buffer += '\t';
+                buffer += to_string(search.distances[id]);
+                buffer += '\n';
+                if (buffer.size() >= output_piece_size)
                 {
-                    cout << *it << graphIn.node_seq(i) << "\t" << dists[i] << endl;
+                    flush();
+                }
+            };
+            if (!all)
+            {
+                for (const int target : targetIds)
+                {
+                    if (search.distances[target] <= maxDist)
+                    {
+                        append_distance(target);
+                    }
                 }
             }
-            else if (vm.count("target"))
+            else if (!bounded)
             {
-                cout << *it << dists[graphIn.get_vertex(vm["target"].as<string>())] << endl;
+                for (size_t id = 0; id < graphIn.nb_nodes(); id++)
+                {
+                    append_distance(id);
+                }
             }
-        }
+            else
+            {
+                vector<u_int32_t> settled(search.settled);
+                sort(settled.begin(), settled.end());
+                for (const u_int32_t id : settled)
+                {
+                    append_distance(id);
+                }
+            }
+        }, cout);
+        cout.flush();
 
     }
     // Extend mode
@@ -192,30 +393,50 @@ int main (int argc, char *argv[])
 
         if (vm.count("unitigs"))
         {
-            // Read in unitigs to extend
-            ifstream unitigsIst(vm["unitigs"].as<string>().c_str());
-            if (!unitigsIst)
+            // Read in unitigs to extend (a unitig not in the graph gets an empty line)
+            vector<string> unitigs = read_sequences(vm["unitigs"].as<string>());
+            vector<int> unitigIds;
+            for (const auto& unitig : unitigs)
             {
-                throw std::runtime_error("Could not open unitig file " + vm["unitigs"].as<string>() + "\n");
+                unitigIds.push_back(graphIn.find_vertex(unitig));
+                if (unitigIds.back() < 0)
+                {
+                    cerr << "Unitig " << unitig << " is not in the graph" << endl;
+                }
             }
 
-            string sequence;
-            while (unitigsIst >> sequence)
+            // Get extensions and print, in the order of the unitigs
+            const int length = vm["length"].as<int>();
+            const bool repeats = vm.count("repeats");
+            const size_t maxPaths = vm["max-paths"].as<size_t>();
+            const size_t maxBytes = vm["max-path-memory"].as<size_t>() << 20;
+            vector<char> truncated(unitigIds.size(), 0);
+            write_in_order(unitigIds.size(), max(1, vm["threads"].as<int>()), [&](const size_t unitigIndex, string& buffer, const int,
+                                                                                   const function<void()>&)
             {
-                // Get extensions and print
-                vector<string> paths = graphIn.extend_hits(sequence, vm["length"].as<int>(), vm.count("repeats"));
+                vector<string> paths;
+                if (unitigIds[unitigIndex] >= 0 &&
+                    !graphIn.extend_hits(unitigIds[unitigIndex], length, repeats, paths, maxPaths, maxBytes))
+                {
+                    truncated[unitigIndex] = 1;
+                }
                 for (auto it = paths.begin(); it != paths.end(); ++it)
                 {
-                    cout << *it;
-                    if (it != paths.end() - 1)
+                    if (it != paths.begin())
                     {
-                        cout << ",";
+                        buffer += ',';
                     }
+                    buffer += *it;
                 }
-                cout << endl;;
-            }
+                buffer += '\n';
+            }, cout);
+            cout.flush();
 
-            unitigsIst.close();
+            size_t nbTruncated = count(truncated.begin(), truncated.end(), 1);
+            if (nbTruncated > 0)
+            {
+                cerr << nbTruncated << " unitigs had more paths than --max-paths or --max-path-memory: only the first were written" << endl;
+            }
         }
         else
         {
@@ -16,176 +16,505 @@
 
 #include "node_dists.hpp"
 
-// Graph initialisation
-Cdbg::Cdbg(const string& dbgPrefix)
-   : Cdbg(dbgPrefix + ".nodes", dbgPrefix + ".edges.dbg")
+#include <cstring>
+#include <limits>
+#include <functional>
+#include <stdexcept>
+#include <boost/filesystem.hpp>
+
+// Binary cache of the graph: a header, then the arrays, each padded to 8 bytes
+static const char CACHE_MAGIC[8] = {'C', 'D', 'B', 'G', 'C', 'S', 'R', '1'};
+struct CacheHeader {
+    char magic[8];
+    u_int64_t nbNodes, nbAdjacencies, nbSeqWords, indexSize;
+    // the text files the cache was built from
+    u_int64_t nodesFileSize, nodesFileTime, edgesFileSize, edgesFileTime;
+};
+
+static u_int64_t padded(u_int64_t nbBytes) { return (nbBytes + 7) & ~(u_int64_t)7; }
+
+static string cache_filename(const string& nodeFile) { return nodeFile + ".cdbg"; }
+
+// 2-bit code of a base, -1 if it is not one of ACGT
+static inline int base_code(const char base)
 {
+    switch (base)
+    {
+        case 'A': case 'a': return 0;
+        case 'C': case 'c': return 1;
+        case 'G': case 'g': return 2;
+        case 'T': case 't': return 3;
+        default: return -1;
+    }
 }
 
-Cdbg::Cdbg(const string& nodeFile, const string& edgeFile)
+// Packs a sequence in 32 bases per word (the unused bits of the last word are 0), returns false if it is not all ACGT
+static bool pack_sequence(const char* sequence, const size_t length, u_int64_t* words)
 {
-    int nbContigs = getNbLinesInFile(nodeFile);
-    _dbgGraph = graph_t(nbContigs);
+    fill(words, words + (length + 31) / 32, 0);
+    for (size_t i = 0; i < length; i++)
+    {
+        int code = base_code(sequence[i]);
+        if (code < 0)
+        {
+            return false;
+        }
+        words[i >> 5] |= (u_int64_t)code << ((i & 31) << 1);
+    }
+    return true;
+}
 
-    // Create the nodes
-    ifstream nodeIst(nodeFile.c_str());
-    if (!nodeIst)
+static u_int64_t hash_sequence(const u_int64_t* words, const u_int64_t length)
+{
+    u_int64_t hash = length * 0x9E3779B97F4A7C15ULL;
+    for (u_int64_t i = 0; i < (length + 31) / 32; i++)
     {
-        throw std::runtime_error("Could not open node file " + nodeFile + "\n");
+        hash ^= words[i];
+        hash *= 0xFF51AFD7ED558CCDULL;
+        hash ^= hash >> 32;
     }
+    return hash;
+}
 
-    int id;
-    string sequence;
-    while (nodeIst >> id >> sequence)
+// Text files are mapped in memory to be parsed (empty files are not mapped)
+static void map_text_file(const string& filename, const string& description, boost::iostreams::mapped_file_source& file,
+                          const char*& begin, const char*& end)
+{
+    if (!boost::filesystem::is_regular_file(filename))
     {
-        MyVertex vF = vertex(id, _dbgGraph);
-        _dbgGraph[vF].name = sequence;
-        _dbgGraph[vF].length = sequence.length();
-        _dbgGraph[vF].id = id;
-        _seqs[sequence] = id;
+        throw std::runtime_error("Could not open " + description + " file " + filename + "\n");
     }
+    begin = end = NULL;
+    if (boost::filesystem::file_size(filename) > 0)
+    {
+        file.open(filename);
+        begin = file.data();
+        end = begin + file.size();
+    }
+}
 
-    nodeIst.close();
+static inline bool is_space(const char c) { return c == ' ' || c == '\t' || c == '\n' || c == '\r'; }
 
-    // Create the edges
-    ifstream edgeIst(edgeFile.c_str());
-    if (!edgeIst)
+// The next whitespace separated token, as read by ifstream >>
+static bool next_token(const char*& pos, const char* end, const char*& token, size_t& length)
+{
+    while (pos < end && is_space(*pos))
     {
-        throw std::runtime_error("Could not open edge file " + edgeFile + "\n");
+        pos++;
     }
-
-    int from, to;
-    int index = 0;
-    string label;
-    while (edgeIst >> from >> to >> label)
+    token = pos;
+    while (pos < end && !is_space(*pos))
     {
-        MyVertex fromVertex = vertex(from, _dbgGraph);
-        MyVertex toVertex = vertex(to, _dbgGraph);
+        pos++;
+    }
+    length = pos - token;
+    return length > 0;
+}
 
-        // Add from -> to
-        pair<MyEdge, bool> return_from_forward_edge = add_edge(fromVertex,
-                                                           toVertex,
-                                                           _dbgGraph);
-        if (return_from_forward_edge.second) {
-            _dbgGraph[return_from_forward_edge.first].id = index;
-            _dbgGraph[return_from_forward_edge.first].weight = _dbgGraph[fromVertex].length;
-            index++;
+static u_int32_t parse_id(const char* token, const size_t length, const u_int64_t nbNodes, const string& filename)
+{
+    u_int64_t id = 0;
+    for (size_t i = 0; i < length; i++)
+    {
+        if (token[i] < '0' || token[i] > '9')
+        {
+            throw std::runtime_error("Invalid node id " + string(token, length) + " in " + filename + "\n");
         }
-
-        // Add to -> from
-        pair<MyEdge, bool> return_from_to_edge = add_edge(toVertex,
-                                                           fromVertex,
-                                                           _dbgGraph);
-        if (return_from_to_edge.second) {
-            _dbgGraph[return_from_to_edge.first].id = index;
-            _dbgGraph[return_from_to_edge.first].weight = _dbgGraph[toVertex].length;
-            index++;
+        id = id * 10 + (token[i] - '0');
+        if (id >= nbNodes)
+        {
+            throw std::runtime_error("Node id " + string(token, length) + " out of range in " + filename + "\n");
         }
     }
-    edgeIst.close();
+    return id;
 }
 
-// Graph algorithms
+// Graph initialisation
+Cdbg::Cdbg(const string& dbgPrefix)
+   : Cdbg(dbgPrefix + ".nodes", dbgPrefix + ".edges.dbg")
+{
+}
 
-// Shortest distance with Dijkstra's algorithm
-vector<int> Cdbg::node_distance(const int origin_id)
+Cdbg::Cdbg(const string& nodeFile, const string& edgeFile)
 {
-    vector<int> distances(num_vertices(_dbgGraph));
-    fill(distances.begin(), distances.end(), 0);
+    string cacheFile = cache_filename(nodeFile);
+    if (!load_cache(cacheFile, nodeFile, edgeFile))
+    {
+        parse_text(nodeFile, edgeFile);
+        save_cache(cacheFile, nodeFile, edgeFile);
+    }
+}
 
-    MyVertex originVertex = vertex(origin_id, _dbgGraph);
-    dijkstra_shortest_paths(_dbgGraph, originVertex, weight_map(boost::get(&EdgeInfo::weight, _dbgGraph)).
-                            distance_map(boost::make_iterator_property_map(distances.begin(),
-                                                                           boost::get(boost::vertex_index, _dbgGraph))));
+string Cdbg::build_cache(const string& nodeFile, const string& edgeFile)
+{
+    Cdbg graph(nodeFile, edgeFile);
+    return cache_filename(nodeFile);
+}
 
-    return(distances);
+void Cdbg::point_to_storage()
+{
+    _adjOffsets = _adjOffsetsStorage.data();
+    _adjacency = _adjacencyStorage.data();
+    _seqWordOffsets = _seqWordOffsetsStorage.data();
+    _seqLengths = _seqLengthsStorage.data();
+    _seqWords = _seqWordsStorage.data();
+    _seqIndex = _seqIndexStorage.data();
 }
 
-vector<string> Cdbg::extend_hits(const int origin_id, const int length, const bool repeats)
+void Cdbg::parse_text(const string& nodeFile, const string& edgeFile)
 {
-    vector<string> pathSeqs;
-    vector<vector<int>> uniquePaths;
+    // Create the nodes: their sequences are packed from the mapped file
+    boost::iostreams::mapped_file_source nodeText;
+    const char *pos, *end, *token;
+    size_t length;
+    map_text_file(nodeFile, "node", nodeText, pos, end);
+    vector< pair<const char*, u_int32_t> > sequences;
+    while (next_token(pos, end, token, length))
+    {
+        u_int32_t id = parse_id(token, length, numeric_limits<u_int32_t>::max(), nodeFile);
+        if (!next_token(pos, end, token, length))
+        {
+            break;
+        }
+        if (id >= sequences.size())
+        {
+            sequences.resize(id + 1, make_pair((const char*)NULL, 0));
+        }
+        sequences[id] = make_pair(token, length);
+    }
+    _nbNodes = sequences.size();
 
-    // Get paths in terms of nodeIds
-    vector<vector<int>> paths = walk_enumeration(_dbgGraph, origin_id, length, repeats);
+    _seqLengthsStorage.resize(_nbNodes);
+    _seqWordOffsetsStorage.assign(_nbNodes + 1, 0);
+    for (u_int64_t id = 0; id < _nbNodes; id++)
+    {
+        _seqLengthsStorage[id] = sequences[id].second;
+        _seqWordOffsetsStorage[id + 1] = _seqWordOffsetsStorage[id] + (sequences[id].second + 31) / 32;
+    }
+    _seqWordsStorage.resize(_seqWordOffsetsStorage[_nbNodes]);
+    for (u_int64_t id = 0; id < _nbNodes; id++)
+    {
+        if (!pack_sequence(sequences[id].first, sequences[id].second, &_seqWordsStorage[_seqWordOffsetsStorage[id]]))
+        {
+            throw std::runtime_error("Node " + to_string(id) + " of " + nodeFile + " has bases other than ACGT\n");
+        }
+    }
+    vector< pair<const char*, u_int32_t> >().swap(sequences);
+    nodeText.close();
 
-    // Paths from longest to shortest
-    for (auto pathIt = paths.rbegin(); pathIt != paths.rend(); ++pathIt)
+    // Index the nodes by their sequence
+    u_int64_t indexSize = 2;
+    while (indexSize < 2 * _nbNodes)
     {
-        string pathSeq = "";
-        vector<int> pathVisits;
-        for (auto nodeIt = pathIt->begin(); nodeIt != pathIt->end(); ++nodeIt)
+        indexSize <<= 1;
+    }
+    _indexMask = indexSize - 1;
+    _seqIndexStorage.assign(indexSize, 0);
+    for (u_int64_t id = 0; id < _nbNodes; id++)
+    {
+        u_int64_t slot = hash_sequence(&_seqWordsStorage[_seqWordOffsetsStorage[id]], _seqLengthsStorage[id]) & _indexMask;
+        while (_seqIndexStorage[slot] != 0)
         {
-            MyVertex vF = vertex(*nodeIt, _dbgGraph);
-            pathVisits.push_back(_dbgGraph[vF].id);
-            pathSeq = pathSeq + _dbgGraph[vF].name;
+            slot = (slot + 1) & _indexMask;
         }
+        _seqIndexStorage[slot] = id + 1;
+    }
 
-        // Check if path already covered by another, longer path
-        int covered = 0;
-        for (auto uniqueIt = uniquePaths.begin(); uniqueIt != uniquePaths.end(); ++uniqueIt)
+    // Create the edges, both ways: the file is read twice, to count the neighbours of each node, then to place them
+    boost::iostreams::mapped_file_source edgeText;
+    const char *edgesBegin, *edgesEnd;
+    map_text_file(edgeFile, "edge", edgeText, edgesBegin, edgesEnd);
+    _adjOffsetsStorage.assign(_nbNodes + 1, 0);
+    for (int pass = 0; pass < 2; pass++)
+    {
+        vector<u_int64_t> nextSlot;
+        if (pass == 1)
         {
-            if (includes(uniqueIt->begin(), uniqueIt->end(), pathVisits.begin(), pathVisits.end()))
+            for (u_int64_t id = 0; id < _nbNodes; id++)
             {
-                covered = 1;
-                break;
+                _adjOffsetsStorage[id + 1] += _adjOffsetsStorage[id];
             }
+            _adjacencyStorage.resize(_adjOffsetsStorage[_nbNodes]);
+            nextSlot.assign(_adjOffsetsStorage.begin(), _adjOffsetsStorage.end() - 1);
         }
-
-        // Add path if not covered
-        if (!covered)
+        pos = edgesBegin;
+        const char *fromToken, *toToken;
+        size_t fromLength, toLength;
+        while (next_token(pos, edgesEnd, fromToken, fromLength) && next_token(pos, edgesEnd, toToken, toLength) &&
+               next_token(pos, edgesEnd, token, length))
         {
-            pathSeqs.push_back(pathSeq);
-            uniquePaths.push_back(pathVisits);
+            u_int32_t from = parse_id(fromToken, fromLength, _nbNodes, edgeFile);
+            u_int32_t to = parse_id(toToken, toLength, _nbNodes, edgeFile);
+            if (pass == 0)
+            {
+                _adjOffsetsStorage[from + 1]++;
+                _adjOffsetsStorage[to + 1]++;
+            }
+            else
+            {
+                _adjacencyStorage[nextSlot[from]++] = to;
+                _adjacencyStorage[nextSlot[to]++] = from;
+            }
         }
     }
-    return pathSeqs;
+    edgeText.close();
+
+    // Each edge is only kept once (the file has them in both directions)
+    u_int64_t nbAdjacencies = 0;
+    for (u_int64_t id = 0; id < _nbNodes; id++)
+    {
+        auto first = _adjacencyStorage.begin() + _adjOffsetsStorage[id];
+        auto last = _adjacencyStorage.begin() + _adjOffsetsStorage[id + 1];
+        sort(first, last);
+        last = unique(first, last);
+        _adjOffsetsStorage[id] = nbAdjacencies;
+        nbAdjacencies = copy(first, last, _adjacencyStorage.begin() + nbAdjacencies) - _adjacencyStorage.begin();
+    }
+    _adjOffsetsStorage[_nbNodes] = nbAdjacencies;
+    _adjacencyStorage.resize(nbAdjacencies);
+    _adjacencyStorage.shrink_to_fit();
+
+    point_to_storage();
+}
+
+// The cache is used if it was built from the current nodes and edges files
+bool Cdbg::load_cache(const string& cacheFile, const string& nodeFile, const string& edgeFile)
+{
+    if (!boost::filesystem::is_regular_file(cacheFile) || !boost::filesystem::is_regular_file(nodeFile) ||
+        !boost::filesystem::is_regular_file(edgeFile) || boost::filesystem::file_size(cacheFile) < sizeof(CacheHeader))
+    {
+        return false;
+    }
+    try
+    {
+        _cacheFile.open(cacheFile);
+    }
+    catch (std::exception& e)
+    {
+        return false;
+    }
+
+    CacheHeader header;
+    memcpy(&header, _cacheFile.data(), sizeof(header));
+    u_int64_t expectedSize = sizeof(header) + padded((header.nbNodes + 1) * sizeof(u_int64_t)) +
+                             padded(header.nbAdjacencies * sizeof(u_int32_t)) + padded((header.nbNodes + 1) * sizeof(u_int64_t)) +
+                             padded(header.nbNodes * sizeof(u_int32_t)) + padded(header.nbSeqWords * sizeof(u_int64_t)) +
+                             padded(header.indexSize * sizeof(u_int32_t));
+    if (memcmp(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) != 0 || _cacheFile.size() != expectedSize ||
+        header.nodesFileSize != boost::filesystem::file_size(nodeFile) ||
+        header.nodesFileTime != (u_int64_t)boost::filesystem::last_write_time(nodeFile) ||
+        header.edgesFileSize != boost::filesystem::file_size(edgeFile) ||
+        header.edgesFileTime != (u_int64_t)boost::filesystem::last_write_time(edgeFile))
+    {
+        _cacheFile.close();
+        return false;
+    }
+
+    const char* pos = _cacheFile.data() + sizeof(header);
+    _nbNodes = header.nbNodes;
+    _indexMask = header.indexSize - 1;
+    _adjOffsets = (const u_int64_t*)pos;
+    pos += padded((_nbNodes + 1) * sizeof(u_int64_t));
+    _adjacency = (const u_int32_t*)pos;
+    pos += padded(header.nbAdjacencies * sizeof(u_int32_t));
+    _seqWordOffsets = (const u_int64_t*)pos;
+    pos += padded((_nbNodes + 1) * sizeof(u_int64_t));
+    _seqLengths = (const u_int32_t*)pos;
+    pos += padded(_nbNodes * sizeof(u_int32_t));
+    _seqWords = (const u_int64_t*)pos;
+    pos += padded(header.nbSeqWords * sizeof(u_int64_t));
+    _seqIndex = (const u_int32_t*)pos;
+    return true;
 }
 
-// Helper functions
+// Written aside then renamed, so that a partial cache is never read; the graph can still be used if it cannot be written
+void Cdbg::save_cache(const string& cacheFile, const string& nodeFile, const string& edgeFile) const
+{
+    CacheHeader header;
+    memcpy(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+    header.nbNodes = _nbNodes;
+    header.nbAdjacencies = _adjOffsets[_nbNodes];
+    header.nbSeqWords = _seqWordOffsets[_nbNodes];
+    header.indexSize = _indexMask + 1;
+    header.nodesFileSize = boost::filesystem::file_size(nodeFile);
+    header.nodesFileTime = boost::filesystem::last_write_time(nodeFile);
+    header.edgesFileSize = boost::filesystem::file_size(edgeFile);
+    header.edgesFileTime = boost::filesystem::last_write_time(edgeFile);
 
-// Recursively visits neighbour nodes to form paths
-vector<vector<int>> walk_enumeration(const graph_t& graph, const int start_node, const int length, const bool repeats)
+    string partFile = cacheFile + ".part";
+    ofstream cacheOst(partFile.c_str(), ios::binary);
+    auto write_array = [&cacheOst](const void* data, u_int64_t nbBytes)
+    {
+        static const char zeros[8] = {0};
+        cacheOst.write((const char*)data, nbBytes);
+        cacheOst.write(zeros, padded(nbBytes) - nbBytes);
+    };
+    write_array(&header, sizeof(header));
+    write_array(_adjOffsets, (_nbNodes + 1) * sizeof(u_int64_t));
+    write_array(_adjacency, header.nbAdjacencies * sizeof(u_int32_t));
+    write_array(_seqWordOffsets, (_nbNodes + 1) * sizeof(u_int64_t));
+    write_array(_seqLengths, _nbNodes * sizeof(u_int32_t));
+    write_array(_seqWords, header.nbSeqWords * sizeof(u_int64_t));
+    write_array(_seqIndex, header.indexSize * sizeof(u_int32_t));
+    cacheOst.close();
+    if (!cacheOst || rename(partFile.c_str(), cacheFile.c_str()) != 0)
+    {
+        cerr << "Could not write the graph cache " << cacheFile << ": the text files will be parsed again next time" << endl;
+        remove(partFile.c_str());
+    }
+}
+
+// Node lookups
+
+int Cdbg::get_vertex(const string& sequence) const
 {
-    vector<vector<int>> path_list = {{start_node}};
-    auto neighbours = boost::adjacent_vertices(start_node, graph);
-    for (auto neighbour : boost::make_iterator_range(neighbours))
+    int id = find_vertex(sequence);
+    if (id < 0)
     {
-        MyVertex vF = vertex(neighbour, graph);
-        if (length - graph[vF].length >= 0)
+        throw std::runtime_error("Sequence " + sequence + " is not a node of the graph\n");
+    }
+    return id;
+}
+
+int Cdbg::find_vertex(const string& sequence) const
+{
+    vector<u_int64_t> words((sequence.length() + 31) / 32);
+    if (pack_sequence(sequence.c_str(), sequence.length(), words.data()))
+    {
+        for (u_int64_t slot = hash_sequence(words.data(), sequence.length()) & _indexMask; _seqIndex[slot] != 0;
+             slot = (slot + 1) & _indexMask)
         {
-            auto paths = walk_enumeration(graph, graph[vF].id, length - graph[vF].length, repeats);
-            for (auto path = paths.begin() ; path != paths.end() ; ++path)
+            u_int32_t id = _seqIndex[slot] - 1;
+            if (_seqLengths[id] == sequence.length() && equal(words.begin(), words.end(), _seqWords + _seqWordOffsets[id]))
             {
-                // Check if path has a repeat, and stop if so
-                if (!repeats)
-                {
-                    auto search_it = find(path->begin(), path->end(), start_node);
-                    if (search_it != path->end())
-                    {
-                        break;
-                    }
-                }
-                path->insert(path->begin(), start_node);
-                path_list.push_back(*path);
-
+                return id;
             }
         }
     }
-    return path_list;
+    return -1;
+}
+
+std::string Cdbg::node_seq(const int id) const
+{
+    string sequence;
+    append_node_seq(id, sequence);
+    return sequence;
 }
 
-long int getNbLinesInFile(const string &filename) {
-    ifstream ist(filename.c_str());
-    if (!ist)
+void Cdbg::append_node_seq(const int id, string& buffer) const
+{
+    size_t begin = buffer.length();
+    buffer.resize(begin + _seqLengths[id]);
+    const u_int64_t* words = _seqWords + _seqWordOffsets[id];
+    for (size_t i = 0; i < _seqLengths[id]; i++)
     {
-        throw std::runtime_error("Could not open file " + filename + "\n");
+        buffer[begin + i] = "ACGT"[(words[i >> 5] >> ((i & 31) << 1)) & 3];
     }
+}
 
-    // Number of lines in the file
-    long int n = std::count(std::istreambuf_iterator<char>(ist), std::istreambuf_iterator<char>(), '\n');
+// Graph algorithms
 
-    ist.close();
+// Shortest distance with Dijkstra's algorithm (going through a node costs its length; unreachable nodes are at INT_MAX)
+vector<int> Cdbg::node_distance(const int origin_id) const
+{
+    DistanceSearch search;
+    node_distance(origin_id, search, numeric_limits<int>::max());
+    return(search.distances);
+}
 
-    return n;
+void Cdbg::node_distance(const int origin_id, DistanceSearch& search, const int max_dist,
+                         const vector<char>* isTarget, const size_t nbTargets) const
+{
+    // Reset what the previous search reached
+    if (search.distances.size() != _nbNodes)
+    {
+        search.distances.assign(_nbNodes, numeric_limits<int>::max());
+    }
+    else
+    {
+        for (u_int32_t node : search.reached)
+        {
+            search.distances[node] = numeric_limits<int>::max();
+        }
+    }
+    search.reached.clear();
+    search.settled.clear();
+    search.heap.clear();
+
+    // Each (distance, node) is pushed at most once (only on a strict improvement), so a node is settled when it is
+    // popped with its current distance
+    typedef pair<int, u_int32_t> QueueItem;
+    greater<QueueItem> heapOrder;
+    size_t nbTargetsSettled = 0;
+    search.distances[origin_id] = 0;
+    search.reached.push_back(origin_id);
+    search.heap.push_back(make_pair(0, origin_id));
+    while (!search.heap.empty())
+    {
+        pop_heap(search.heap.begin(), search.heap.end(), heapOrder);
+        QueueItem item = search.heap.back();
+        search.heap.pop_back();
+        if (item.first > search.distances[item.second])
+        {
+            continue;
+        }
+        if (item.first > max_dist)
+        {
+            break;
+        }
+        search.settled.push_back(item.second);
+        if (isTarget != NULL && (*isTarget)[item.second] && ++nbTargetsSettled == nbTargets)
+        {
+            break;
+        }
+
+        int distance = item.first + _seqLengths[item.second];
+        auto range = neighbours(item.second);
+        for (const u_int32_t* neighbour = range.first; neighbour != range.second; ++neighbour)
+        {
+            if (distance < search.distances[*neighbour])
+            {
+                if (search.distances[*neighbour] == numeric_limits<int>::max())
+                {
+                    search.reached.push_back(*neighbour);
+                }
+                search.distances[*neighbour] = distance;
+                search.heap.push_back(make_pair(distance, *neighbour));
+                push_heap(search.heap.begin(), search.heap.end(), heapOrder);
+            }
+        }
+    }
+}
+
+vector<string> Cdbg::extend_hits(const int origin_id, const int length, const bool repeats) const
+{
+    vector<string> pathSeqs;
+    extend_hits(origin_id, length, repeats, pathSeqs, numeric_limits<size_t>::max(), numeric_limits<size_t>::max());
+    return pathSeqs;
+}
+
+// Only the maximal paths are kept: the others are covered by (are prefixes of) one of them
+bool Cdbg::extend_hits(const int origin_id, const int length, const bool repeats, vector<string>& pathSeqs,
+                       const size_t max_paths, const size_t max_bytes) const
+{
+    size_t nbBytes = 0;
+    return walk_enumeration(*this, origin_id, length, repeats, [&](const vector<int>& path) -> bool
+    {
+        if (pathSeqs.size() >= max_paths)
+        {
+            return false;
+        }
+        string pathSeq;
+        for (const int node : path)
+        {
+            append_node_seq(node, pathSeq);
+        }
+        nbBytes += pathSeq.length();
+        if (nbBytes > max_bytes)
+        {
+            return false;
+        }
+        pathSeqs.push_back(std::move(pathSeq));
+        return true;
+    });
 }
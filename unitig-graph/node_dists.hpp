@@ -12,69 +12,141 @@
  *
  *  This code: John Lees 2019
  *
+ * The graph is kept in compressed sparse row form: the neighbours of node i are
+ * adjacency[adjOffsets[i]..adjOffsets[i+1]), sorted, each edge of the .edges.dbg
+ * file being followed both ways. The node sequences are 2-bit packed, each starting
+ * on a 64-bit word, and found from their sequence by an open addressing hash table of
+ * node ids (so the sequences are not kept a second time as keys).
+ *
+ * Parsing the text files is only done once: the arrays are then saved in a binary
+ * cache next to them (<nodes file>.cdbg), which is mapped in memory by the next runs
+ * as long as the nodes and edges files are unchanged.
+ *
  */
 
 #include <iostream>
 #include <fstream>
 #include <cstdlib>
 #include <algorithm>
-#include <unordered_map>
+#include <string>
+#include <vector>
+#include <utility>
+#include <sys/types.h>
 
-#include <boost/config.hpp>
-#include <boost/graph/graph_traits.hpp>
-#include <boost/graph/adjacency_list.hpp>
-#include <boost/property_map/property_map.hpp>
-#include <boost/graph/properties.hpp>
-#include <boost/graph/labeled_graph.hpp>
-#include <boost/graph/dijkstra_shortest_paths.hpp>
-#include <boost/graph/subgraph.hpp>
+#include <boost/iostreams/device/mapped_file.hpp>
 
 using namespace std;
 
-// Vertex metadata
-struct VertexInfo {
-    string name;
-    int length;
-    int id;
+// The state of the distance searches of a thread: it is kept from one search to the next, so that only the nodes
+// reached by the previous search are reset (and not the whole graph)
+struct DistanceSearch {
+    vector<int> distances;       // INT_MAX if not reached
+    vector<u_int32_t> reached;   // the nodes whose distance is set
+    vector<u_int32_t> settled;   // the nodes whose distance is final, in increasing distance
+    vector< pair<int, u_int32_t> > heap;
 };
 
-// Edge metadata
-struct EdgeInfo {
-    int id;
-    int weight;
-};
-
-// Use recommended typedefs
-typedef boost::property<boost::vertex_index_t, std::size_t, VertexInfo> vertex_prop;
-typedef boost::property<boost::edge_index_t, std::size_t, EdgeInfo> edge_prop;
-typedef boost::adjacency_list <boost::setS, boost::vecS, boost::directedS, vertex_prop, edge_prop> adjlist_t;
-typedef boost::subgraph< adjlist_t > graph_t;
-typedef boost::graph_traits<adjlist_t>::vertex_descriptor MyVertex;
-typedef boost::graph_traits<adjlist_t>::edge_descriptor MyEdge;
-
 class Cdbg
 {
     public:
         // Initialisation
         Cdbg(const string& dbgPrefix);
         Cdbg(const string& nodeFile, const string& edgeFile);
+        // The arrays may point into the mapped cache
+        Cdbg(const Cdbg&) = delete;
+        Cdbg& operator=(const Cdbg&) = delete;
+
+        // Converts the text files to the binary cache (if it is not up to date), returns the name of the cache
+        static string build_cache(const string& nodeFile, const string& edgeFile);
 
         // Non-modifying operations
-        MyVertex get_vertex(const string& sequence) { return vertex(_seqs[sequence], _dbgGraph); }
-        MyVertex get_vertex(const int id) { return vertex(id, _dbgGraph); }
-        std::string node_seq(const int id) { MyVertex vF = vertex(id, _dbgGraph); return _dbgGraph[vF].name; }
-        vector<int> node_distance(const int origin_id);
-        vector<int> node_distance(const string& origin_seq) { return node_distance(_seqs[origin_seq]); }
-        vector<string> extend_hits(const int origin_id, const int length, const bool repeats=0);
-        vector<string> extend_hits(const string& origin_seq, const int length, const bool repeats=0)
-                                  { return extend_hits(_seqs[origin_seq], length, repeats); }
+        size_t nb_nodes() const { return _nbNodes; }
+        int get_vertex(const string& sequence) const;
+        int find_vertex(const string& sequence) const; // -1 if the sequence is not a node
+        int get_vertex(const int id) const { return id; }
+        int node_length(const int id) const { return _seqLengths[id]; }
+        std::string node_seq(const int id) const;
+        void append_node_seq(const int id, string& buffer) const;
+        pair<const u_int32_t*, const u_int32_t*> neighbours(const int id) const
+                                  { return make_pair(_adjacency + _adjOffsets[id], _adjacency + _adjOffsets[id + 1]); }
+        vector<int> node_distance(const int origin_id) const;
+        // Dijkstra from origin_id, stopped once the distances are above max_dist, or once the nbTargets nodes flagged in
+        // isTarget (if given) are settled. The distances of the settled nodes are final; those of the nodes within
+        // max_dist are final too if the search was not stopped by its targets
+        void node_distance(const int origin_id, DistanceSearch& search, const int max_dist,
+                           const vector<char>* isTarget = NULL, const size_t nbTargets = 0) const;
+        vector<int> node_distance(const string& origin_seq) const { return node_distance(get_vertex(origin_seq)); }
+        // The sequences of the maximal paths from origin_id, extending it by up to length bases
+        // Appends them to pathSeqs, stopping after max_paths paths or max_bytes of sequences: returns false if it stopped
+        bool extend_hits(const int origin_id, const int length, const bool repeats, vector<string>& pathSeqs,
+                         const size_t max_paths, const size_t max_bytes) const;
+        vector<string> extend_hits(const int origin_id, const int length, const bool repeats=0) const;
+        vector<string> extend_hits(const string& origin_seq, const int length, const bool repeats=0) const
+                                  { return extend_hits(get_vertex(origin_seq), length, repeats); }
 
     protected:
-        graph_t _dbgGraph;
-        unordered_map<string, int> _seqs;
+        // The arrays of the graph, in the owned vectors below or in the mapped cache
+        u_int64_t _nbNodes, _indexMask;
+        const u_int64_t *_adjOffsets;
+        const u_int32_t *_adjacency;
+        const u_int64_t *_seqWordOffsets;
+        const u_int32_t *_seqLengths;
+        const u_int64_t *_seqWords;
+        const u_int32_t *_seqIndex; // node id + 1, 0 for an empty slot
+
+        vector<u_int64_t> _adjOffsetsStorage, _seqWordOffsetsStorage, _seqWordsStorage;
+        vector<u_int32_t> _adjacencyStorage, _seqLengthsStorage, _seqIndexStorage;
+        boost::iostreams::mapped_file_source _cacheFile;
+
+        void parse_text(const string& nodeFile, const string& edgeFile);
+        bool load_cache(const string& cacheFile, const string& nodeFile, const string& edgeFile);
+        void save_cache(const string& cacheFile, const string& nodeFile, const string& edgeFile) const;
+        void point_to_storage();
 };
 
 // Helper functions
-vector<vector<int>> walk_enumeration(const graph_t& graph, const int start_node, const int length, const bool repeats=0);
-long int getNbLinesInFile(const string &filename);
 
+// Enumerates the maximal paths from start_node whose nodes (after it) add up to at most length bases, without going
+// through a node twice unless repeats. The walk is a depth-first search over a stack of the path prefix: each path is
+// given to emit(path) when it cannot be extended any further, and the walk stops if emit returns false (it then
+// returns false). The paths come in the order of the recursive enumeration from the last neighbour to the first.
+template<typename Emit>
+bool walk_enumeration(const Cdbg& graph, const int start_node, const int length, const bool repeats, Emit emit)
+{
+    // The neighbours of the node at each depth of the path that are left to visit, and the length left after it
+    struct Frame {
+        const u_int32_t *first, *next;
+        int remaining;
+        bool extended;
+    };
+    vector<int> path(1, start_node);
+    vector<Frame> stack;
+    auto range = graph.neighbours(start_node);
+    stack.push_back(Frame{range.first, range.second, length, false});
+    while (!stack.empty())
+    {
+        Frame& frame = stack.back();
+        if (frame.next == frame.first)
+        {
+            if (!frame.extended && !emit(path))
+            {
+                return false;
+            }
+            stack.pop_back();
+            path.pop_back();
+            continue;
+        }
+
+        const int neighbour = *--frame.next;
+        const int remaining = frame.remaining - graph.node_length(neighbour);
+        if (remaining < 0 || (!repeats && find(path.begin(), path.end(), neighbour) != path.end()))
+        {
+            continue;
+        }
+        frame.extended = true;
+        path.push_back(neighbour);
+        range = graph.neighbours(neighbour);
+        stack.push_back(Frame{range.first, range.second, remaining, false});
+    }
+    return true;
+}